@@ -0,0 +1,277 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "asynclock.h"
+
+#include "config.h"
+
+struct _AsyncLock {
+    gchar *name;
+    guint rank;
+    GMutex mutex;
+    gboolean held;
+    GQueue waiters;
+};
+
+typedef struct {
+    gint priority;
+    gint64 queued;
+    AsyncLockFunc func;
+    gpointer user_data;
+    GMainContext *context;
+} Waiter;
+
+/* Several locks being taken in turn */
+typedef struct {
+    AsyncLock **locks;
+    guint n_locks;
+    guint n_held;
+    gint priority;
+    gint64 started;
+    AsyncLockFunc func;
+    gpointer user_data;
+} Acquisition;
+
+static guint n_locks_created = 0;
+
+static gboolean
+run_waiter (gpointer user_data)
+{
+    Waiter *waiter = (Waiter *) user_data;
+
+    waiter->func (g_get_monotonic_time () - waiter->queued, waiter->user_data);
+    g_main_context_unref (waiter->context);
+    g_free (waiter);
+    return G_SOURCE_REMOVE;
+}
+
+/* Hand the lock to @waiter, in its main context */
+static void
+grant (Waiter *waiter)
+{
+    GSource *source;
+
+    source = g_idle_source_new ();
+    g_source_set_priority (source, waiter->priority);
+    g_source_set_callback (source, run_waiter, waiter, NULL);
+    g_source_attach (source, waiter->context);
+    g_source_unref (source);
+}
+
+AsyncLock *
+async_lock_new (const gchar *name)
+{
+    AsyncLock *lock;
+
+    lock = g_new0 (AsyncLock, 1);
+    lock->name = g_strdup (name);
+    lock->rank = g_atomic_int_add (&n_locks_created, 1);
+    g_mutex_init (&lock->mutex);
+    g_queue_init (&lock->waiters);
+    return lock;
+}
+
+void
+async_lock_free (AsyncLock *lock)
+{
+    if (lock == NULL)
+        return;
+
+    if (lock->held || !g_queue_is_empty (&lock->waiters))
+        g_warning ("Freeing the %s lock while in use", lock->name);
+    g_mutex_clear (&lock->mutex);
+    g_free (lock->name);
+    g_free (lock);
+}
+
+/* Queue @waiter behind those of the same or a more urgent priority */
+static void
+enqueue (AsyncLock *lock,
+         Waiter *waiter)
+{
+    GList *l;
+
+    for (l = lock->waiters.head; l != NULL; l = l->next)
+        if (((Waiter *) l->data)->priority > waiter->priority)
+            break;
+    if (l != NULL)
+        g_queue_insert_before (&lock->waiters, l, waiter);
+    else
+        g_queue_push_tail (&lock->waiters, waiter);
+}
+
+/**
+ * async_lock_acquire_async:
+ * @lock: the lock
+ * @priority: the urgency of the caller, such as %G_PRIORITY_DEFAULT
+ * @func: called once @lock is held
+ * @user_data: passed to @func
+ *
+ * Queues @func, to be called from the thread-default main context of the
+ * caller, at @priority, once @lock is held. @func is never called before
+ * this returns.
+ */
+
+void
+async_lock_acquire_async (AsyncLock *lock,
+                          gint priority,
+                          AsyncLockFunc func,
+                          gpointer user_data)
+{
+    Waiter *waiter;
+    gboolean granted = FALSE;
+
+    waiter = g_new0 (Waiter, 1);
+    waiter->priority = priority;
+    waiter->queued = g_get_monotonic_time ();
+    waiter->func = func;
+    waiter->user_data = user_data;
+    waiter->context = g_main_context_ref_thread_default ();
+
+    g_mutex_lock (&lock->mutex);
+    if (!lock->held) {
+        lock->held = TRUE;
+        granted = TRUE;
+    } else
+        enqueue (lock, waiter);
+    g_mutex_unlock (&lock->mutex);
+
+    if (granted)
+        grant (waiter);
+}
+
+static gint
+compare_ranks (gconstpointer a,
+               gconstpointer b)
+{
+    const AsyncLock *lock_a = *(const AsyncLock * const *) a;
+    const AsyncLock *lock_b = *(const AsyncLock * const *) b;
+
+    return (lock_a->rank > lock_b->rank) - (lock_a->rank < lock_b->rank);
+}
+
+static void
+on_acquired_one (gint64 wait,
+                 gpointer user_data)
+{
+    Acquisition *acquisition = (Acquisition *) user_data;
+
+    if (++acquisition->n_held < acquisition->n_locks) {
+        async_lock_acquire_async (acquisition->locks[acquisition->n_held], acquisition->priority,
+                                  on_acquired_one, acquisition);
+        return;
+    }
+
+    acquisition->func (g_get_monotonic_time () - acquisition->started, acquisition->user_data);
+    g_free (acquisition->locks);
+    g_free (acquisition);
+}
+
+/**
+ * async_lock_acquire_all_async:
+ * @locks: the locks
+ * @n_locks: the number of @locks, at least one
+ * @priority: the urgency of the caller, such as %G_PRIORITY_DEFAULT
+ * @func: called once all @locks are held
+ * @user_data: passed to @func
+ *
+ * Like #async_lock_acquire_async, for several locks. They are taken one
+ * after the other, in the order they were created, whatever their order
+ * in @locks; @func releases each of them.
+ */
+
+void
+async_lock_acquire_all_async (AsyncLock * const *locks,
+                              guint n_locks,
+                              gint priority,
+                              AsyncLockFunc func,
+                              gpointer user_data)
+{
+    Acquisition *acquisition;
+
+    g_return_if_fail (n_locks > 0);
+
+    acquisition = g_new0 (Acquisition, 1);
+    acquisition->locks = g_new (AsyncLock *, n_locks);
+    memcpy (acquisition->locks, locks, n_locks * sizeof (AsyncLock *));
+    acquisition->n_locks = n_locks;
+    acquisition->priority = priority;
+    acquisition->started = g_get_monotonic_time ();
+    acquisition->func = func;
+    acquisition->user_data = user_data;
+    qsort (acquisition->locks, n_locks, sizeof (AsyncLock *), compare_ranks);
+
+    async_lock_acquire_async (acquisition->locks[0], priority, on_acquired_one, acquisition);
+}
+
+/**
+ * async_lock_try_acquire:
+ * @lock: the lock
+ *
+ * Takes @lock if it is free and nobody waits for it, for callers which
+ * cannot wait, such as property getters.
+ *
+ * Returns: %TRUE if @lock is now held by the caller
+ */
+
+gboolean
+async_lock_try_acquire (AsyncLock *lock)
+{
+    gboolean acquired = FALSE;
+
+    g_mutex_lock (&lock->mutex);
+    /* release hands a held lock straight to the next waiter, so a free
+     * lock has none; checked anyway, a waiter must never be overtaken */
+    if (!lock->held && g_queue_is_empty (&lock->waiters)) {
+        lock->held = TRUE;
+        acquired = TRUE;
+    }
+    g_mutex_unlock (&lock->mutex);
+    return acquired;
+}
+
+/**
+ * async_lock_release:
+ * @lock: a held lock
+ *
+ * Releases @lock, handing it to the first waiter if any.
+ */
+
+void
+async_lock_release (AsyncLock *lock)
+{
+    Waiter *next;
+
+    g_mutex_lock (&lock->mutex);
+    if (!lock->held) {
+        g_mutex_unlock (&lock->mutex);
+        g_critical ("Releasing the %s lock, which is not held", lock->name);
+        return;
+    }
+    if ((next = g_queue_pop_head (&lock->waiters)) == NULL)
+        lock->held = FALSE;
+    g_mutex_unlock (&lock->mutex);
+
+    if (next != NULL)
+        grant (next);
+}
@@ -0,0 +1,83 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _ASYNC_LOCK_H_
+#define _ASYNC_LOCK_H_
+
+#include <glib.h>
+
+/**
+ * SECTION: asynclock
+ * @short_description: FIFO locks acquired without blocking
+ * @title: Asynchronous locks
+ * @include: asynclock.h
+ *
+ * An #AsyncLock guards a resource, such as the system clock, across
+ * main loop callbacks. Instead of blocking, acquiring it queues a
+ * function which is called from the acquirer's main context once the
+ * lock is granted; the lock is then held until #async_lock_release,
+ * which may be called from any thread, hands it to the next function in
+ * the queue. Waiters are served by priority, the lower value first as
+ * for #GSource priorities, then in the order they asked; a waiter cannot
+ * take the lock from its holder, but goes ahead of the less urgent ones
+ * queued.
+ *
+ * Operations needing several locks take them with
+ * #async_lock_acquire_all_async, always in the order the locks were
+ * created, so that two of them cannot deadlock.
+ */
+
+typedef struct _AsyncLock AsyncLock;
+
+/**
+ * AsyncLockFunc:
+ * @wait: how long the caller waited for the lock, in microseconds
+ * @user_data: the data passed when acquiring
+ *
+ * Called with the lock held; the lock must eventually be released.
+ */
+
+typedef void (*AsyncLockFunc) (gint64 wait,
+                               gpointer user_data);
+
+AsyncLock *
+async_lock_new (const gchar *name);
+
+void
+async_lock_free (AsyncLock *lock);
+
+void
+async_lock_acquire_async (AsyncLock *lock,
+                          gint priority,
+                          AsyncLockFunc func,
+                          gpointer user_data);
+
+void
+async_lock_acquire_all_async (AsyncLock * const *locks,
+                              guint n_locks,
+                              gint priority,
+                              AsyncLockFunc func,
+                              gpointer user_data);
+
+gboolean
+async_lock_try_acquire (AsyncLock *lock);
+
+void
+async_lock_release (AsyncLock *lock);
+
+#endif
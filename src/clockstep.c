@@ -0,0 +1,80 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/timex.h>
+
+#include <glib.h>
+
+#include "clockstep.h"
+
+#include "config.h"
+
+/**
+ * clock_step:
+ * @usec: the offset, in microseconds
+ *
+ * Moves CLOCK_REALTIME by @usec. The kernel adds the offset to the
+ * current time itself, so, unlike clock_gettime + clock_settime, no
+ * time is lost in between, and NTP adjustments cannot slip in.
+ *
+ * Returns: 0, or a negative errno on failure; -EINVAL, -EOPNOTSUPP and
+ * -ENOSYS mean that the kernel does not support it
+ */
+
+int
+clock_step (gint64 usec)
+{
+    struct timex tx;
+
+    memset (&tx, 0, sizeof (tx));
+    tx.modes = ADJ_SETOFFSET | ADJ_NANO;
+    tx.time.tv_sec = usec / G_USEC_PER_SEC;
+    /* tv_usec holds nanoseconds with ADJ_NANO, and must not be
+     * negative */
+    tx.time.tv_usec = (usec % G_USEC_PER_SEC) * 1000;
+    if (tx.time.tv_usec < 0) {
+        tx.time.tv_sec--;
+        tx.time.tv_usec += 1000000000;
+    }
+    if (clock_adjtime (CLOCK_REALTIME, &tx) < 0)
+        return -errno;
+    return 0;
+}
+
+/**
+ * clock_step_realtime_offset:
+ *
+ * Only changes when the system clock is stepped: slewing and frequency
+ * corrections apply to both clocks.
+ *
+ * Returns: CLOCK_REALTIME - CLOCK_MONOTONIC, in microseconds
+ */
+
+gint64
+clock_step_realtime_offset (void)
+{
+    struct timespec real, mono;
+
+    clock_gettime (CLOCK_MONOTONIC, &mono);
+    clock_gettime (CLOCK_REALTIME, &real);
+    return (real.tv_sec - mono.tv_sec) * G_USEC_PER_SEC + (real.tv_nsec - mono.tv_nsec) / 1000;
+}
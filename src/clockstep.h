@@ -0,0 +1,42 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _CLOCK_STEP_H_
+#define _CLOCK_STEP_H_
+
+#include <glib.h>
+
+/**
+ * SECTION: clockstep
+ * @short_description: Stepping the system clock
+ * @title: Clock step
+ * @include: clockstep.h
+ *
+ * Moves CLOCK_REALTIME by an offset in the kernel, with
+ * clock_adjtime(ADJ_SETOFFSET), so that no time is lost between reading
+ * and setting the clock, and tells steps apart by the distance between
+ * CLOCK_REALTIME and CLOCK_MONOTONIC.
+ */
+
+int
+clock_step (gint64 usec);
+
+gint64
+clock_step_realtime_offset (void);
+
+#endif
@@ -0,0 +1,353 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "clockthread.h"
+
+#include "config.h"
+
+/* Locked in memory, like the queues and the histogram, so that the
+ * thread never waits for a page to be faulted in */
+#define STACK_SIZE (256 * 1024)
+
+/* One slot is always left empty to tell a full ring from an empty one.
+ * SetTime holds the clock lock until its job completes, so there is
+ * rarely more than one job in flight */
+#define QUEUE_SIZE 16
+/* Leaves room in the job ring for the stop request, and makes sure that
+ * every job in flight has a completion slot */
+#define MAX_IN_FLIGHT (QUEUE_SIZE - 2)
+
+/* Scheduling latency buckets: under 1 us, then [2^(i-1), 2^i) us for
+ * bucket i, the last one gathering everything above */
+#define N_BUCKETS 24
+
+typedef struct {
+    ClockThreadFunc func;
+    ClockThreadFunc done;
+    gpointer user_data;
+    /* CLOCK_MONOTONIC when the job was queued */
+    gint64 queued;
+} Job;
+
+/* Lock-free single producer, single consumer ring */
+typedef struct {
+    Job jobs[QUEUE_SIZE];
+    /* Next slot to read, only written by the consumer */
+    gint head;
+    /* Next slot to write, only written by the producer */
+    gint tail;
+} Ring;
+
+/* From the main thread to the clock thread */
+static Ring queue;
+/* From the clock thread back to the main thread */
+static Ring completions;
+static gint latency[N_BUCKETS];
+
+static gboolean running = FALSE;
+static pthread_t thread;
+static void *stack = NULL;
+/* Wakes the clock thread up */
+static int wakeup_fd = -1;
+/* Wakes the main loop up */
+static int completion_fd = -1;
+static guint completion_source_id = 0;
+/* Jobs queued and not completed yet, only used by the main thread */
+static guint in_flight = 0;
+
+static gboolean
+ring_push (Ring *ring,
+           const Job *job)
+{
+    gint tail = ring->tail;
+    gint next = (tail + 1) % QUEUE_SIZE;
+
+    if (next == g_atomic_int_get (&ring->head))
+        return FALSE;
+    ring->jobs[tail] = *job;
+    /* Publishes the slot written above */
+    g_atomic_int_set (&ring->tail, next);
+    return TRUE;
+}
+
+static gboolean
+ring_pop (Ring *ring,
+          Job *job)
+{
+    gint head = ring->head;
+
+    if (head == g_atomic_int_get (&ring->tail))
+        return FALSE;
+    *job = ring->jobs[head];
+    g_atomic_int_set (&ring->head, (head + 1) % QUEUE_SIZE);
+    return TRUE;
+}
+
+static void
+signal_fd (int fd)
+{
+    uint64_t one = 1;
+
+    while (write (fd, &one, sizeof (one)) < 0 && errno == EINTR)
+        ;
+}
+
+static void
+record_latency (gint64 usec)
+{
+    guint bucket = usec < 1 ? 0 : MIN (g_bit_storage ((gulong) usec), N_BUCKETS - 1);
+
+    g_atomic_int_inc (&latency[bucket]);
+}
+
+/* Neither allocates nor takes a lock: the completion goes through its
+ * own ring, which always has room for it */
+static void *
+run_thread (void *arg)
+{
+    pthread_setname_np (pthread_self (), "timedated-clock");
+
+    for (;;) {
+        uint64_t n;
+        Job job;
+
+        if (read (wakeup_fd, &n, sizeof (n)) < 0 && errno != EINTR) {
+            g_critical ("Clock thread: unable to wait for jobs: %s", strerror (errno));
+            return NULL;
+        }
+
+        while (ring_pop (&queue, &job)) {
+            /* Queued by clock_thread_destroy */
+            if (job.func == NULL)
+                return NULL;
+
+            record_latency (g_get_monotonic_time () - job.queued);
+            job.func (job.user_data);
+            ring_push (&completions, &job);
+            signal_fd (completion_fd);
+        }
+    }
+}
+
+static void
+run_completions (void)
+{
+    Job job;
+
+    while (ring_pop (&completions, &job)) {
+        in_flight--;
+        if (job.done != NULL)
+            job.done (job.user_data);
+    }
+}
+
+static gboolean
+on_completion (gint fd,
+               GIOCondition condition,
+               gpointer user_data)
+{
+    uint64_t n;
+
+    if (read (fd, &n, sizeof (n)) < 0 && errno != EAGAIN && errno != EINTR)
+        g_warning ("Clock thread: unable to read the completions: %s", strerror (errno));
+    run_completions ();
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+close_fds (void)
+{
+    if (wakeup_fd >= 0)
+        close (wakeup_fd);
+    if (completion_fd >= 0)
+        close (completion_fd);
+    wakeup_fd = completion_fd = -1;
+}
+
+/**
+ * clock_thread_init:
+ * @priority: the SCHED_FIFO priority of the thread, 1 to 99
+ *
+ * Starts the clock thread. When the process may not use real-time
+ * scheduling, the thread is run with the normal policy instead.
+ *
+ * Returns: %TRUE if the thread runs
+ */
+
+gboolean
+clock_thread_init (gint priority)
+{
+    pthread_attr_t attr;
+    struct sched_param param;
+    gboolean realtime = TRUE;
+    int r;
+
+    wakeup_fd = eventfd (0, EFD_CLOEXEC);
+    completion_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wakeup_fd < 0 || completion_fd < 0) {
+        g_warning ("Unable to start the clock thread: %s", strerror (errno));
+        close_fds ();
+        return FALSE;
+    }
+
+    stack = mmap (NULL, STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) {
+        g_warning ("Unable to allocate the clock thread stack: %s", strerror (errno));
+        stack = NULL;
+        close_fds ();
+        return FALSE;
+    }
+    if (mlock (stack, STACK_SIZE) < 0 ||
+        mlock (&queue, sizeof (queue)) < 0 ||
+        mlock (&completions, sizeof (completions)) < 0 ||
+        mlock (latency, sizeof (latency)) < 0)
+        g_warning ("Unable to lock the clock thread memory: %s", strerror (errno));
+
+    pthread_attr_init (&attr);
+    pthread_attr_setstack (&attr, stack, STACK_SIZE);
+    pthread_attr_setinheritsched (&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy (&attr, SCHED_FIFO);
+    memset (&param, 0, sizeof (param));
+    param.sched_priority = priority;
+    pthread_attr_setschedparam (&attr, &param);
+    r = pthread_create (&thread, &attr, run_thread, NULL);
+    if (r == EPERM) {
+        g_warning ("Not allowed to use real-time scheduling, the clock thread runs with the normal policy");
+        realtime = FALSE;
+        pthread_attr_setinheritsched (&attr, PTHREAD_INHERIT_SCHED);
+        r = pthread_create (&thread, &attr, run_thread, NULL);
+    }
+    pthread_attr_destroy (&attr);
+    if (r != 0) {
+        g_warning ("Unable to start the clock thread: %s", strerror (r));
+        munmap (stack, STACK_SIZE);
+        stack = NULL;
+        close_fds ();
+        return FALSE;
+    }
+
+    completion_source_id = g_unix_fd_add_full (G_PRIORITY_HIGH, completion_fd, G_IO_IN,
+                                               on_completion, NULL, NULL);
+    if (realtime)
+        g_debug ("Clock thread started with SCHED_FIFO priority %d", priority);
+    else
+        g_debug ("Clock thread started with the normal policy");
+    running = TRUE;
+    return TRUE;
+}
+
+/**
+ * clock_thread_run:
+ * @func: run in the clock thread
+ * @done: (nullable): then run in the default main context, at
+ * %G_PRIORITY_HIGH
+ * @user_data: passed to @func and @done
+ *
+ * Queues @func. Must be called from the main thread, the only producer.
+ * @func should do nothing but the time critical part of the job; the
+ * rest belongs in @done.
+ *
+ * Returns: %FALSE when the thread does not run or too many jobs are in
+ * flight, in which case the caller does the job itself
+ */
+
+gboolean
+clock_thread_run (ClockThreadFunc func,
+                  ClockThreadFunc done,
+                  gpointer user_data)
+{
+    Job job = { func, done, user_data, g_get_monotonic_time () };
+
+    g_return_val_if_fail (func != NULL, FALSE);
+
+    if (!running || in_flight >= MAX_IN_FLIGHT)
+        return FALSE;
+    if (!ring_push (&queue, &job))
+        return FALSE;
+    in_flight++;
+    signal_fd (wakeup_fd);
+    return TRUE;
+}
+
+/**
+ * clock_thread_get_latency:
+ *
+ * Returns: (transfer floating): the non-empty buckets of the scheduling
+ * latency histogram, as an a(tt) array of their upper bound in
+ * microseconds (%G_MAXUINT64 for the last one) and their count; empty
+ * when the thread does not run
+ */
+
+GVariant *
+clock_thread_get_latency (void)
+{
+    GVariantBuilder builder;
+    guint i;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(tt)"));
+    for (i = 0; running && i < N_BUCKETS; i++) {
+        guint count = (guint) g_atomic_int_get (&latency[i]);
+
+        if (count > 0)
+            g_variant_builder_add (&builder, "(tt)",
+                                   i == N_BUCKETS - 1 ? G_MAXUINT64 : (guint64) 1 << i,
+                                   (guint64) count);
+    }
+    return g_variant_builder_end (&builder);
+}
+
+void
+clock_thread_destroy (void)
+{
+    Job stop = { NULL, NULL, NULL, 0 };
+
+    if (!running)
+        return;
+
+    /* Let the queued jobs run, then stop. The job ring always has room
+     * for this one */
+    ring_push (&queue, &stop);
+    signal_fd (wakeup_fd);
+    pthread_join (thread, NULL);
+    running = FALSE;
+    run_completions ();
+
+    g_source_remove (completion_source_id);
+    completion_source_id = 0;
+    munlock (latency, sizeof (latency));
+    munlock (&completions, sizeof (completions));
+    munlock (&queue, sizeof (queue));
+    munmap (stack, STACK_SIZE);
+    stack = NULL;
+    close_fds ();
+    memset (&queue, 0, sizeof (queue));
+    memset (&completions, 0, sizeof (completions));
+    memset (latency, 0, sizeof (latency));
+}
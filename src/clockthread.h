@@ -0,0 +1,65 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _CLOCK_THREAD_H_
+#define _CLOCK_THREAD_H_
+
+#include <glib.h>
+
+/**
+ * SECTION: clockthread
+ * @short_description: Real-time thread setting the clocks
+ * @title: Clock thread
+ * @include: clockthread.h
+ *
+ * An optional thread, run with the SCHED_FIFO policy, which sets the
+ * system clock, so that the time it is set to does not depend on when
+ * the main loop gets the processor back. Its stack and its queues are
+ * locked in memory. Jobs are handed to it from the main thread through a
+ * lock-free single producer, single consumer queue, and come back the
+ * same way to have their completion called in the main loop, so the
+ * thread neither allocates nor takes a lock. The time each job waits for
+ * the thread to run is kept in a histogram.
+ */
+
+/* Highest SCHED_FIFO priority accepted by clock_thread_init, see
+ * clockthread in timedated.conf */
+#define CLOCK_THREAD_MAX_PRIORITY 99
+
+/**
+ * ClockThreadFunc:
+ * @user_data: the data passed to #clock_thread_run
+ */
+
+typedef void (*ClockThreadFunc) (gpointer user_data);
+
+gboolean
+clock_thread_init (gint priority);
+
+void
+clock_thread_destroy (void);
+
+gboolean
+clock_thread_run (ClockThreadFunc func,
+                  ClockThreadFunc done,
+                  gpointer user_data);
+
+GVariant *
+clock_thread_get_latency (void);
+
+#endif
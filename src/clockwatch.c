@@ -0,0 +1,134 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/timerfd.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "clockwatch.h"
+
+#include "config.h"
+
+/* The latest time a time_t holds, as systemd uses for the same timer:
+ * the clock never reaches it with a 64-bit time_t */
+#define TIME_T_MAX ((time_t) (((guint64) 1 << (sizeof (time_t) * 8 - 1)) - 1))
+
+static int timer_fd = -1;
+static guint timer_source_id = 0;
+static ClockWatchFunc watch_func = NULL;
+static gpointer watch_user_data = NULL;
+
+static gboolean
+arm (void)
+{
+    struct itimerspec its;
+    struct timespec now;
+
+    /* An expiry already past would make the fd readable at once, and
+     * forever */
+    if (clock_gettime (CLOCK_REALTIME, &now) == 0 && now.tv_sec >= TIME_T_MAX) {
+        g_warning ("The system clock is past the clock step timer, no longer watching for steps");
+        return FALSE;
+    }
+
+    memset (&its, 0, sizeof (its));
+    its.it_value.tv_sec = TIME_T_MAX;
+    if (timerfd_settime (timer_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL) < 0) {
+        g_warning ("Unable to arm the clock step timer: %s", strerror (errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean
+on_timer (gint fd,
+          GIOCondition condition,
+          gpointer user_data)
+{
+    guint64 expirations;
+    gboolean armed;
+
+    if (read (fd, &expirations, sizeof (expirations)) >= 0) {
+        /* Reached TIME_T_MAX: not a step */
+        if (arm ())
+            return G_SOURCE_CONTINUE;
+        timer_source_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+    if (errno != ECANCELED) {
+        if (errno != EAGAIN && errno != EINTR)
+            g_warning ("Unable to read the clock step timer: %s", strerror (errno));
+        return G_SOURCE_CONTINUE;
+    }
+
+    g_debug ("The system clock was set");
+    /* Re-arm first, so that a step during the callback is not missed */
+    armed = arm ();
+    if (watch_func != NULL)
+        watch_func (watch_user_data);
+    if (armed)
+        return G_SOURCE_CONTINUE;
+    timer_source_id = 0;
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * clock_watch_init:
+ * @func: called on the main loop after each step of the system clock
+ * @user_data: passed to @func
+ */
+
+void
+clock_watch_init (ClockWatchFunc func,
+                  gpointer user_data)
+{
+    watch_func = func;
+    watch_user_data = user_data;
+
+    if ((timer_fd = timerfd_create (CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+        g_warning ("Unable to create the clock step timer: %s", strerror (errno));
+        return;
+    }
+    if (!arm ()) {
+        close (timer_fd);
+        timer_fd = -1;
+        return;
+    }
+    timer_source_id = g_unix_fd_add (timer_fd, G_IO_IN, on_timer, NULL);
+}
+
+void
+clock_watch_destroy (void)
+{
+    if (timer_source_id != 0) {
+        g_source_remove (timer_source_id);
+        timer_source_id = 0;
+    }
+    if (timer_fd >= 0) {
+        close (timer_fd);
+        timer_fd = -1;
+    }
+    watch_func = NULL;
+    watch_user_data = NULL;
+}
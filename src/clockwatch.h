@@ -0,0 +1,46 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _CLOCK_WATCH_H_
+#define _CLOCK_WATCH_H_
+
+#include <glib.h>
+
+/**
+ * SECTION: clockwatch
+ * @short_description: Notification of system clock steps
+ * @title: Clock watch
+ * @include: clockwatch.h
+ *
+ * Calls back whenever CLOCK_REALTIME is set, by timedated or by anything
+ * else (date -s, ntpd -q, a hypervisor), without polling: an absolute
+ * CLOCK_REALTIME timer armed with TFD_TIMER_CANCEL_ON_SET in the far
+ * future is cancelled by the kernel on every clock step. Slewing the
+ * clock does not count as a step.
+ */
+
+typedef void (*ClockWatchFunc) (gpointer user_data);
+
+void
+clock_watch_init (ClockWatchFunc func,
+                  gpointer user_data);
+
+void
+clock_watch_destroy (void);
+
+#endif
@@ -34,41 +34,113 @@
 #include <ctype.h>
 #include <sys/prctl.h>
 #include <sys/time.h>
+#include <poll.h>
 #include <linux/rtc.h>
 
 #include "macro.h"
 #include "util.h"
 #include "hwclock.h"
 
-static int rtc_open(int flags) {
+/* The device resolved by rtc_resolve(), kept for the life of the daemon
+ * so that each access is a single open(). We do not keep the device open
+ * itself: rtc character devices can only be opened once, and holding
+ * the fd would lock hwclock(8) out. */
+static char *rtc_path = NULL;
+
+/* The primary device chosen in the configuration, if any */
+static char *rtc_fixed_path = NULL;
+
+static int ioctl_open(const char *path, int flags) {
         int fd;
+
+        fd = open(path, flags);
+        return fd < 0 ? -errno : fd;
+}
+
+static void ioctl_close(int fd) {
+        close_nointr_nofail(fd);
+}
+
+static int ioctl_read_time(int fd, struct tm *tm) {
+        return ioctl(fd, RTC_RD_TIME, tm) < 0 ? -errno : 0;
+}
+
+static int ioctl_set_time(int fd, const struct tm *tm) {
+        return ioctl(fd, RTC_SET_TIME, tm) < 0 ? -errno : 0;
+}
+
+static int ioctl_update_irq(int fd, bool enable) {
+        return ioctl(fd, enable ? RTC_UIE_ON : RTC_UIE_OFF, 0) < 0 ? -errno : 0;
+}
+
+static int ioctl_wait_update(int fd, int timeout_ms) {
+        struct pollfd pfd;
+        unsigned long data;
+        int r;
+
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        r = poll(&pfd, 1, timeout_ms);
+        if (r < 0)
+                return -errno;
+        if (r == 0)
+                return 0;
+
+        /* Acknowledge the interrupt */
+        if (read(fd, &data, sizeof(data)) < 0)
+                return -errno;
+        return 1;
+}
+
+static const struct hwclock_backend ioctl_backend = {
+        .name = "ioctl",
+        .default_device = NULL,
+        .open = ioctl_open,
+        .close = ioctl_close,
+        .read_time = ioctl_read_time,
+        .set_time = ioctl_set_time,
+        .update_irq = ioctl_update_irq,
+        .wait_update = ioctl_wait_update,
+};
+
+static const struct hwclock_backend *backend = &ioctl_backend;
+
+void hwclock_set_backend(const struct hwclock_backend *b) {
+        backend = b ? b : &ioctl_backend;
+        hwclock_invalidate_device();
+}
+
+const struct hwclock_backend *hwclock_get_backend(void) {
+        return backend;
+}
+
+static int rtc_resolve(char **ret) {
         DIR *d;
+        struct dirent *de;
 
         /* First, we try to make use of the /dev/rtc symlink. If that
-         * doesn't exist, we open the first RTC which has hctosys=1
+         * doesn't exist, we use the first RTC which has hctosys=1
          * set. If we don't find any we just take the first RTC that
          * exists at all. */
 
-        fd = open("/dev/rtc", flags);
-        if (fd >= 0)
-                return fd;
+        if (backend->default_device) {
+                *ret = strdup(backend->default_device);
+                return *ret ? 0 : -ENOMEM;
+        }
+
+        if (access("/dev/rtc", F_OK) >= 0) {
+                *ret = strdup("/dev/rtc");
+                return *ret ? 0 : -ENOMEM;
+        }
 
         d = opendir("/sys/class/rtc");
         if (!d)
                 goto fallback;
 
-        for (;;) {
+        while ((de = readdir(d))) {
                 char *p, *v;
-                struct dirent buf, *de;
                 int r;
 
-                r = readdir_r(d, &buf, &de);
-                if (r != 0)
-                        goto fallback;
-
-                if (!de)
-                        goto fallback;
-
                 if (ignore_file(de->d_name))
                         continue;
 
@@ -91,24 +163,106 @@ static int rtc_open(int flags) {
                         continue;
 
                 p = strappend("/dev/", de->d_name);
-                fd = open(p, flags);
-                free(p);
-
-                if (fd >= 0) {
+                if (!p) {
                         closedir(d);
-                        return fd;
+                        return -ENOMEM;
+                }
+                if (access(p, F_OK) >= 0) {
+                        closedir(d);
+                        *ret = p;
+                        return 0;
                 }
+                free(p);
         }
 
 fallback:
         if (d)
                 closedir(d);
 
-        fd = open("/dev/rtc0", flags);
-        if (fd < 0)
-                return -errno;
+        *ret = strdup("/dev/rtc0");
+        return *ret ? 0 : -ENOMEM;
+}
+
+static bool rtc_gone(int err) {
+        return err == ENODEV || err == ENXIO || err == ENOENT;
+}
+
+static int rtc_open(int flags) {
+        int fd, r;
+
+        if (rtc_fixed_path)
+                return backend->open(rtc_fixed_path, flags);
+
+        if (!rtc_path) {
+                r = rtc_resolve(&rtc_path);
+                if (r < 0)
+                        return r;
+        }
+
+        fd = backend->open(rtc_path, flags);
+        if (fd >= 0 || !rtc_gone(-fd))
+                return fd;
+
+        /* The device went away since we resolved it, look again */
+        hwclock_invalidate_device();
+        r = rtc_resolve(&rtc_path);
+        if (r < 0)
+                return r;
+
+        return backend->open(rtc_path, flags);
+}
+
+/* Opens @path, or the primary device when @path is NULL */
+static int rtc_open_device(const char *path, int flags) {
+        if (!path)
+                return rtc_open(flags);
+
+        return backend->open(path, flags);
+}
+
+static void rtc_check_gone(const char *path, int err) {
+        if (!path && rtc_gone(-err))
+                hwclock_invalidate_device();
+}
+
+void hwclock_invalidate_device(void) {
+        free(rtc_path);
+        rtc_path = NULL;
+}
+
+int hwclock_set_device(const char *path) {
+        char *p = NULL;
+
+        if (path) {
+                p = strdup(path);
+                if (!p)
+                        return -ENOMEM;
+        }
+
+        free(rtc_fixed_path);
+        rtc_fixed_path = p;
+        hwclock_invalidate_device();
+        return 0;
+}
+
+int hwclock_get_device(char **ret) {
+        int r;
 
-        return fd;
+        assert(ret);
+
+        if (rtc_fixed_path) {
+                *ret = strdup(rtc_fixed_path);
+                return *ret ? 0 : -ENOMEM;
+        }
+
+        if (!rtc_path) {
+                r = rtc_resolve(&rtc_path);
+                if (r < 0)
+                        return r;
+        }
+
+        *ret = strdup(rtc_path);
+        return *ret ? 0 : -ENOMEM;
 }
 
 int hwclock_get_time(struct tm *tm) {
@@ -119,40 +273,186 @@ int hwclock_get_time(struct tm *tm) {
 
         fd = rtc_open(O_RDONLY|O_CLOEXEC);
         if (fd < 0)
-                return -errno;
+                return fd;
 
         /* This leaves the timezone fields of struct tm
          * uninitialized! */
-        if (ioctl(fd, RTC_RD_TIME, tm) < 0)
-                err = -errno;
+        err = backend->read_time(fd, tm);
+        if (rtc_gone(-err))
+                hwclock_invalidate_device();
 
         /* We don't know daylight saving, so we reset this in order not
          * to confused mktime(). */
         tm->tm_isdst = -1;
 
-        close_nointr_nofail(fd);
+        backend->close(fd);
 
         return err;
 }
 
-int hwclock_set_time(const struct tm *tm) {
+int hwclock_set_time_device(const char *path, const struct tm *tm) {
         int fd;
         int err = 0;
 
         assert(tm);
 
+        fd = rtc_open_device(path, O_RDONLY|O_CLOEXEC);
+        if (fd < 0)
+                return fd;
+
+        err = backend->set_time(fd, tm);
+        rtc_check_gone(path, err);
+
+        backend->close(fd);
+
+        return err;
+}
+
+int hwclock_set_time(const struct tm *tm) {
+        return hwclock_set_time_device(NULL, tm);
+}
+
+/* How often the rtc is polled for a change of second when it cannot
+ * deliver update interrupts */
+#define RTC_POLL_INTERVAL_USEC (USEC_PER_MSEC)
+
+static int rtc_wait_tick_polled(int fd, usec_t deadline, struct tm *tm) {
+        struct tm start;
+        int r;
+
+        /* Same as hwclock(8) does without interrupts: read until the
+         * seconds field changes */
+        r = backend->read_time(fd, &start);
+        if (r < 0)
+                return r;
+
+        for (;;) {
+                if (now(CLOCK_MONOTONIC) >= deadline)
+                        return -ETIMEDOUT;
+                usleep(RTC_POLL_INTERVAL_USEC);
+                r = backend->read_time(fd, tm);
+                if (r < 0)
+                        return r;
+                if (tm->tm_sec != start.tm_sec)
+                        return 0;
+        }
+}
+
+static int rtc_wait_tick(int fd, usec_t deadline, struct tm *tm) {
+        int r;
+
+        r = backend->update_irq(fd, true);
+        if (r == -EINVAL || r == -ENOTTY)
+                return rtc_wait_tick_polled(fd, deadline, tm);
+        if (r < 0)
+                return r;
+
+        for (;;) {
+                usec_t n = now(CLOCK_MONOTONIC);
+
+                if (n >= deadline) {
+                        r = -ETIMEDOUT;
+                        goto finish;
+                }
+
+                /* Round up, so that we do not spin on the last ms */
+                r = backend->wait_update(fd, (int) ((deadline - n + USEC_PER_MSEC - 1) / USEC_PER_MSEC));
+                if (r == -EINTR)
+                        continue;
+                if (r < 0)
+                        goto finish;
+                if (r > 0)
+                        break;
+        }
+
+        /* The update-ended interrupt fired: the rtc just moved to a new
+         * second, which is what RTC_RD_TIME reads now */
+        r = backend->read_time(fd, tm);
+
+finish:
+        backend->update_irq(fd, false);
+        return r;
+}
+
+/* Reads the rtc at the instant it moves to a new second. @edge is the
+ * CLOCK_MONOTONIC time at which that happened, so the caller knows the
+ * rtc read @tm + (now - @edge). Gives up with -ETIMEDOUT after
+ * @timeout. */
+int hwclock_get_time_aligned(struct tm *tm, usec_t timeout, usec_t *edge) {
+        usec_t deadline;
+        int fd;
+        int err;
+
+        assert(tm);
+        assert(edge);
+
         fd = rtc_open(O_RDONLY|O_CLOEXEC);
         if (fd < 0)
-                return -errno;
+                return fd;
 
-        if (ioctl(fd, RTC_SET_TIME, tm) < 0)
-                err = -errno;
+        deadline = now(CLOCK_MONOTONIC) + timeout;
+        err = rtc_wait_tick(fd, deadline, tm);
+        *edge = now(CLOCK_MONOTONIC);
+        if (rtc_gone(-err))
+                hwclock_invalidate_device();
 
-        close_nointr_nofail(fd);
+        tm->tm_isdst = -1;
+
+        backend->close(fd);
 
         return err;
 }
 
+/* Sets the rtc from the system clock at the next whole second of
+ * CLOCK_REALTIME, so that the sub-second part is not simply dropped
+ * by RTC_SET_TIME. @path is NULL for the primary device. Fails with -ETIMEDOUT without touching the rtc if
+ * the next second is more than @timeout away. */
+int hwclock_set_time_aligned_device(const char *path, bool local, usec_t timeout) {
+        struct timespec ts;
+        struct tm tm;
+        time_t t;
+        int fd;
+        int err = 0;
+        int r;
+
+        assert_se(clock_gettime(CLOCK_REALTIME, &ts) == 0);
+        if ((usec_t) (NSEC_PER_SEC - ts.tv_nsec) / NSEC_PER_USEC > timeout)
+                return -ETIMEDOUT;
+
+        /* Open first, so that the open() latency is not between the
+         * edge and the write */
+        fd = rtc_open_device(path, O_RDONLY|O_CLOEXEC);
+        if (fd < 0)
+                return fd;
+
+        ts.tv_sec++;
+        ts.tv_nsec = 0;
+        while ((r = clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL)) == EINTR)
+                ;
+        if (r != 0) {
+                err = -r;
+                goto finish;
+        }
+
+        t = ts.tv_sec;
+        if (local)
+                localtime_r(&t, &tm);
+        else
+                gmtime_r(&t, &tm);
+
+        err = backend->set_time(fd, &tm);
+        rtc_check_gone(path, err);
+
+finish:
+        backend->close(fd);
+
+        return err;
+}
+
+int hwclock_set_time_aligned(bool local, usec_t timeout) {
+        return hwclock_set_time_aligned_device(NULL, local, timeout);
+}
+
 int hwclock_apply_localtime_delta(int *min) {
         const struct timeval *tv_null = NULL;
         struct timespec ts;
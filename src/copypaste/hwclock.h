@@ -22,11 +22,39 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 
+/* How the rtc devices are accessed. Every function returns a negative
+ * errno on failure. */
+struct hwclock_backend {
+        const char *name;
+        /* Device used when none is configured; NULL to look for one
+         * in /sys/class/rtc */
+        const char *default_device;
+        int (*open)(const char *path, int flags);
+        void (*close)(int fd);
+        int (*read_time)(int fd, struct tm *tm);
+        int (*set_time)(int fd, const struct tm *tm);
+        /* -EINVAL or -ENOTTY when the device has no update interrupt */
+        int (*update_irq)(int fd, bool enable);
+        /* 1 when the rtc moved to a new second, 0 on timeout */
+        int (*wait_update)(int fd, int timeout_ms);
+};
+
 int hwclock_apply_localtime_delta(int *min);
 int hwclock_reset_localtime_delta(void);
 int hwclock_get_time(struct tm *tm);
 int hwclock_set_time(const struct tm *tm);
+int hwclock_get_time_aligned(struct tm *tm, uint64_t timeout, uint64_t *edge);
+int hwclock_set_time_aligned(bool local, uint64_t timeout);
+int hwclock_set_time_device(const char *path, const struct tm *tm);
+int hwclock_set_time_aligned_device(const char *path, bool local, uint64_t timeout);
+int hwclock_set_device(const char *path);
+int hwclock_get_device(char **ret);
+void hwclock_invalidate_device(void);
+void hwclock_set_backend(const struct hwclock_backend *backend);
+const struct hwclock_backend *hwclock_get_backend(void);
 
 #endif
@@ -0,0 +1,164 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/timerfd.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "dstwatch.h"
+
+#include "config.h"
+
+static int timer_fd = -1;
+static guint timer_source_id = 0;
+static gchar *watched_timezone = NULL;
+static DstWatchFunc watch_func = NULL;
+static gpointer watch_user_data = NULL;
+
+/* Arm the timer for the next transition after now, or disarm it if the
+ * zone has no more transitions */
+void
+dst_watch_rearm (void)
+{
+    GError *err = NULL;
+    struct itimerspec its;
+    struct timespec ts;
+    TzFile *tzfile;
+    gint64 next;
+
+    if (timer_fd < 0)
+        return;
+
+    memset (&its, 0, sizeof (its));
+    if (watched_timezone == NULL)
+        goto arm;
+    if ((tzfile = tz_file_cache_get (watched_timezone, &err)) == NULL) {
+        g_debug ("Not watching DST transitions: %s", err->message);
+        g_clear_error (&err);
+        goto arm;
+    }
+
+    clock_gettime (CLOCK_REALTIME, &ts);
+    if (!tz_file_next_transition (tzfile, ts.tv_sec, &next)) {
+        g_debug ("No UTC offset change ahead for %s", watched_timezone);
+        goto arm;
+    }
+    its.it_value.tv_sec = next;
+    g_debug ("Next UTC offset change for %s at %" G_GINT64_FORMAT, watched_timezone, next);
+
+  arm:
+    /* A zero it_value disarms the timer */
+    if (timerfd_settime (timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+        g_warning ("Unable to arm the DST transition timer: %s", strerror (errno));
+}
+
+static gboolean
+on_timer (gint fd,
+          GIOCondition condition,
+          gpointer user_data)
+{
+    GError *err = NULL;
+    guint64 expirations;
+    struct timespec ts;
+    TzFile *tzfile;
+    TzOffset offset;
+
+    if (read (fd, &expirations, sizeof (expirations)) < 0 && errno != ECANCELED) {
+        if (errno != EAGAIN)
+            g_warning ("Unable to read the DST transition timer: %s", strerror (errno));
+        return G_SOURCE_CONTINUE;
+    }
+
+    clock_gettime (CLOCK_REALTIME, &ts);
+    if (watched_timezone != NULL && (tzfile = tz_file_cache_get (watched_timezone, &err)) != NULL) {
+        tz_file_lookup (tzfile, ts.tv_sec, &offset);
+        g_debug ("UTC offset of %s is now %d", watched_timezone, offset.utc_offset);
+        if (watch_func != NULL)
+            watch_func (ts.tv_sec, &offset, watch_user_data);
+    } else if (err != NULL) {
+        g_warning ("%s", err->message);
+        g_clear_error (&err);
+    }
+
+    dst_watch_rearm ();
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * dst_watch_init:
+ * @timezone: (nullable): the system time zone
+ * @func: called at each UTC offset change of @timezone
+ * @user_data: passed to @func
+ *
+ * Start watching for the UTC offset changes of @timezone. The zone files
+ * are read through the tzfile cache, which must be initialized.
+ */
+
+void
+dst_watch_init (const gchar *timezone,
+                DstWatchFunc func,
+                gpointer user_data)
+{
+    watch_func = func;
+    watch_user_data = user_data;
+    watched_timezone = g_strdup (timezone);
+
+    if ((timer_fd = timerfd_create (CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+        g_warning ("Unable to create the DST transition timer: %s", strerror (errno));
+        return;
+    }
+    timer_source_id = g_unix_fd_add (timer_fd, G_IO_IN, on_timer, NULL);
+    dst_watch_rearm ();
+}
+
+/**
+ * dst_watch_set_timezone:
+ * @timezone: (nullable): the new system time zone
+ *
+ * Follow a change of the system time zone.
+ */
+
+void
+dst_watch_set_timezone (const gchar *timezone)
+{
+    g_free (watched_timezone);
+    watched_timezone = g_strdup (timezone);
+    dst_watch_rearm ();
+}
+
+void
+dst_watch_destroy (void)
+{
+    if (timer_source_id != 0) {
+        g_source_remove (timer_source_id);
+        timer_source_id = 0;
+    }
+    if (timer_fd >= 0) {
+        close (timer_fd);
+        timer_fd = -1;
+    }
+    g_clear_pointer (&watched_timezone, g_free);
+    watch_func = NULL;
+    watch_user_data = NULL;
+}
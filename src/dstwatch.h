@@ -0,0 +1,57 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _DST_WATCH_H_
+#define _DST_WATCH_H_
+
+#include <glib.h>
+
+#include "tzfile.h"
+
+/**
+ * SECTION: dstwatch
+ * @short_description: Wake up at the UTC offset changes of the system zone
+ * @title: DST watch
+ * @include: dstwatch.h
+ *
+ * Computes the next instant at which the UTC offset of the system time
+ * zone changes, and arms a single absolute CLOCK_REALTIME timerfd for it
+ * on the main loop. When it expires, the callback is called with the
+ * new offset and the timer is armed for the following transition. There
+ * is no polling: between transitions, the daemon does not wake up.
+ */
+
+typedef void (*DstWatchFunc) (gint64 transition,
+                              const TzOffset *offset,
+                              gpointer user_data);
+
+void
+dst_watch_init (const gchar *timezone,
+                DstWatchFunc func,
+                gpointer user_data);
+
+void
+dst_watch_set_timezone (const gchar *timezone);
+
+void
+dst_watch_rearm (void);
+
+void
+dst_watch_destroy (void);
+
+#endif
@@ -46,6 +46,7 @@ static gboolean use_syslog = FALSE;
 static gboolean read_only = FALSE;
 static gboolean print_version = FALSE;
 static gchar *config_file = NULL;
+static gchar *rtc_backend = NULL;
 
 static GMainLoop *loop = NULL;
 static int exit_status = 0;
@@ -57,6 +58,7 @@ static GOptionEntry option_entries[] =
     { "read-only", 0, 0, G_OPTION_ARG_NONE, &read_only, "Run in read-only mode", NULL },
     { "version", 0, 0, G_OPTION_ARG_NONE, &print_version, "Show version information", NULL },
     { "config", 0, 0, G_OPTION_ARG_FILENAME, &config_file, "Use an alternate configuration file", "File" },
+    { "rtc-backend", 0, 0, G_OPTION_ARG_STRING, &rtc_backend, "Access the rtc with this backend (ioctl or fake)", "Backend" },
     { NULL }
 };
 
@@ -205,6 +207,8 @@ timedated_started ()
  * instead of the system log
  * @--read-only: Run daemon in read-only mode: the settings files are read,
  * but cannot be modified
+ * @--rtc-backend: Access the rtc through ioctl (the default), or through
+ * in-memory fake devices, overriding the rtcbackend setting
  *
  * The timedated daemon implements the standard org.freedesktop.timedate1 D-Bus
  * interface as a standalone daemon. Users and administrators should not
@@ -262,6 +266,8 @@ int main(int argc, char *argv[]) {
                 g_clear_error(&error);
     }
     if (timedateconfig == NULL) timedateconfig = TIMEDATECONFIG;
+    if (rtc_backend != NULL)
+        g_key_file_set_string(key_file, "settings", "rtcbackend", rtc_backend);
 
     if (!foreground) {
         if (daemon_retval_init() < 0) {
@@ -301,7 +307,7 @@ int main(int argc, char *argv[]) {
     sigint_id = g_unix_signal_add(SIGINT, on_signal, NULL);
     sigterm_id = g_unix_signal_add(SIGTERM, on_signal, NULL);
 
-    timedated_init(read_only, timedateconfig);
+    timedated_init(read_only, timedateconfig, key_file);
 
     g_main_loop_run(loop);
 
@@ -0,0 +1,136 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <glib.h>
+
+#include "ratelimit.h"
+
+#include "config.h"
+
+struct _RateLimit {
+    gdouble burst;
+    /* Tokens per microsecond */
+    gdouble rate;
+    guint max_keys;
+    GHashTable *buckets;
+};
+
+typedef struct {
+    gdouble tokens;
+    /* CLOCK_MONOTONIC when tokens was last updated */
+    gint64 updated;
+} Bucket;
+
+static gdouble
+refill (RateLimit *limit,
+        Bucket *bucket,
+        gint64 now)
+{
+    return MIN (limit->burst, bucket->tokens + (now - bucket->updated) * limit->rate);
+}
+
+struct prune {
+    RateLimit *limit;
+    gint64 now;
+};
+
+static gboolean
+is_full (gpointer key,
+         gpointer value,
+         gpointer user_data)
+{
+    struct prune *prune = (struct prune *) user_data;
+
+    return refill (prune->limit, (Bucket *) value, prune->now) >= prune->limit->burst;
+}
+
+/**
+ * rate_limit_new:
+ * @burst: the most calls accepted at once from a key, at least one
+ * @per_minute: the calls accepted per minute from a key in the long run,
+ * at least one
+ * @max_keys: the most keys tracked at once
+ *
+ * Returns: a new #RateLimit, to be freed with #rate_limit_free
+ */
+
+RateLimit *
+rate_limit_new (guint burst,
+                guint per_minute,
+                guint max_keys)
+{
+    RateLimit *limit;
+
+    g_return_val_if_fail (burst > 0 && per_minute > 0, NULL);
+
+    limit = g_new0 (RateLimit, 1);
+    limit->burst = burst;
+    limit->rate = per_minute / (60.0 * G_USEC_PER_SEC);
+    limit->max_keys = max_keys;
+    limit->buckets = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    return limit;
+}
+
+void
+rate_limit_free (RateLimit *limit)
+{
+    if (limit == NULL)
+        return;
+    g_hash_table_unref (limit->buckets);
+    g_free (limit);
+}
+
+/**
+ * rate_limit_take:
+ * @limit: the limit
+ * @key: the caller
+ *
+ * Takes a token from the bucket of @key.
+ *
+ * Returns: %FALSE if the call must be refused
+ */
+
+gboolean
+rate_limit_take (RateLimit *limit,
+                 const gchar *key)
+{
+    gint64 now = g_get_monotonic_time ();
+    Bucket *bucket;
+
+    bucket = g_hash_table_lookup (limit->buckets, key);
+    if (bucket == NULL) {
+        if (g_hash_table_size (limit->buckets) >= limit->max_keys) {
+            struct prune prune = { limit, now };
+
+            g_hash_table_foreach_remove (limit->buckets, is_full, &prune);
+        }
+        if (g_hash_table_size (limit->buckets) >= limit->max_keys)
+            return FALSE;
+
+        bucket = g_new (Bucket, 1);
+        bucket->tokens = limit->burst;
+        g_hash_table_insert (limit->buckets, g_strdup (key), bucket);
+    } else
+        bucket->tokens = refill (limit, bucket, now);
+    bucket->updated = now;
+
+    if (bucket->tokens < 1)
+        return FALSE;
+    bucket->tokens -= 1;
+    return TRUE;
+}
@@ -0,0 +1,52 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _RATE_LIMIT_H_
+#define _RATE_LIMIT_H_
+
+#include <glib.h>
+
+/**
+ * SECTION: ratelimit
+ * @short_description: Token buckets keyed by name
+ * @title: Rate limits
+ * @include: ratelimit.h
+ *
+ * Each key, such as a bus name or a uid, has a bucket of up to @burst
+ * tokens, refilled at a steady rate; every call takes a token, and is
+ * refused when the bucket is empty. A bucket which has filled up again
+ * is the same as no bucket, so it is dropped whenever room is needed;
+ * past @max_keys active keys, new keys are refused until some buckets
+ * are full again, which keeps the memory used bounded.
+ */
+
+typedef struct _RateLimit RateLimit;
+
+RateLimit *
+rate_limit_new (guint burst,
+                guint per_minute,
+                guint max_keys);
+
+void
+rate_limit_free (RateLimit *limit);
+
+gboolean
+rate_limit_take (RateLimit *limit,
+                 const gchar *key);
+
+#endif
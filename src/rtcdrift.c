@@ -0,0 +1,508 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/timerfd.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "rtcdrift.h"
+#include "settingsjournal.h"
+
+#include "config.h"
+
+#define SECONDS_PER_DAY 86400
+
+/* Shortest span the drift is fitted over; hwclock(8) uses the same */
+#define MIN_FIT_SPAN (4 * G_TIME_SPAN_HOUR)
+
+/* 1000 ppm. Anything larger means that one of the clocks was stepped
+ * behind our back, not that the rtc drifts. */
+#define MAX_DRIFT_FACTOR 86.4
+
+/* Smallest change of the drift factor, in seconds per day, worth
+ * rewriting /etc/adjtime for */
+#define MIN_SAVED_CHANGE 0.01
+
+/* Past this, every other sample is dropped, but for the first one, so
+ * that the series keeps its span whatever the sampling interval */
+#define MAX_SAMPLES 64
+
+typedef struct {
+    gint64 system;
+    /* rtc - system */
+    gint64 offset;
+} RtcDriftSample;
+
+static gchar *adjtime_path = NULL;
+static gboolean adjtime_exists = FALSE;
+
+/* The three lines of /etc/adjtime */
+static gdouble drift_factor = 0;
+static gint64 last_adjust = 0;
+static gint64 last_calibration = 0;
+static gboolean adjtime_local = FALSE;
+
+/* The drift factor in /etc/adjtime, and whether the other lines are out
+ * of date; the file is rewritten when the factor changes, and on exit */
+static gdouble saved_factor = 0;
+static gboolean adjtime_dirty = FALSE;
+static guint save_source_id = 0;
+static gboolean saving = FALSE;
+
+/* Samples since the rtc was last set, oldest first */
+static GArray *samples = NULL;
+
+static int timer_fd = -1;
+static guint timer_source_id = 0;
+static RtcDriftSampleFunc sample_func = NULL;
+static gpointer sample_user_data = NULL;
+
+static void
+load_adjtime (void)
+{
+    GError *err = NULL;
+    gchar *contents = NULL;
+    gchar **lines = NULL;
+    gdouble factor, adjust;
+    gint64 calibration;
+
+    if (!g_file_get_contents (adjtime_path, &contents, NULL, &err)) {
+        if (!g_error_matches (err, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            g_warning ("%s", err->message);
+        g_error_free (err);
+        return;
+    }
+    adjtime_exists = TRUE;
+
+    lines = g_strsplit (contents, "\n", 4);
+    if (lines[0] == NULL || sscanf (lines[0], "%lf %lf", &factor, &adjust) != 2) {
+        g_warning ("Ignoring %s: unable to parse the drift factor", adjtime_path);
+        goto out;
+    }
+    /* Also rejects NaN and infinities */
+    if (!(ABS (factor) <= MAX_DRIFT_FACTOR)) {
+        g_warning ("Ignoring the drift factor in %s: %f s/day", adjtime_path, factor);
+        goto out;
+    }
+    drift_factor = saved_factor = factor;
+    last_adjust = (gint64) adjust * G_USEC_PER_SEC;
+    if (lines[1] != NULL && sscanf (lines[1], "%" G_GINT64_FORMAT, &calibration) == 1)
+        last_calibration = calibration * G_USEC_PER_SEC;
+    if (lines[1] != NULL && lines[2] != NULL)
+        adjtime_local = !strcmp (g_strstrip (lines[2]), "LOCAL");
+
+    g_debug ("rtc drift: %f s/day since %" G_GINT64_FORMAT, drift_factor, last_adjust / G_USEC_PER_SEC);
+
+  out:
+    g_strfreev (lines);
+    g_free (contents);
+}
+
+/* A snapshot of the three lines, written out of the main loop */
+typedef struct {
+    gchar *contents;
+    gdouble factor;
+    gint64 last_adjust;
+    gboolean local;
+} AdjtimeSave;
+
+static AdjtimeSave *
+adjtime_save_new (void)
+{
+    AdjtimeSave *save;
+
+    save = g_new0 (AdjtimeSave, 1);
+    /* Same layout as hwclock(8) */
+    save->contents = g_strdup_printf ("%f %" G_GINT64_FORMAT " 0.000000\n%" G_GINT64_FORMAT "\n%s\n",
+                                      drift_factor,
+                                      last_adjust / G_USEC_PER_SEC,
+                                      last_calibration / G_USEC_PER_SEC,
+                                      adjtime_local ? "LOCAL" : "UTC");
+    save->factor = drift_factor;
+    save->last_adjust = last_adjust;
+    save->local = adjtime_local;
+    return save;
+}
+
+static void
+adjtime_save_free (AdjtimeSave *save)
+{
+    g_free (save->contents);
+    g_free (save);
+}
+
+static gboolean
+adjtime_save_write (AdjtimeSave *save,
+                    GError **error)
+{
+    GFile *file;
+    SettingsTransaction *transaction;
+    gboolean ret;
+
+    file = g_file_new_for_path (adjtime_path);
+    transaction = settings_transaction_new ();
+    ret = settings_transaction_replace (transaction, file, save->contents, strlen (save->contents), 0644, error) &&
+        settings_transaction_commit (transaction, error);
+    settings_transaction_free (transaction);
+    g_object_unref (file);
+    return ret;
+}
+
+static void
+adjtime_save_done (AdjtimeSave *save,
+                   const GError *error)
+{
+    if (error != NULL) {
+        g_warning ("Unable to save the rtc drift: %s", error->message);
+        return;
+    }
+    adjtime_exists = TRUE;
+    saved_factor = save->factor;
+    /* Unless the rtc was set again in the meantime */
+    if (last_adjust == save->last_adjust && adjtime_local == save->local)
+        adjtime_dirty = FALSE;
+}
+
+static void
+save_adjtime (void)
+{
+    GError *err = NULL;
+    AdjtimeSave *save;
+
+    save = adjtime_save_new ();
+    adjtime_save_write (save, &err);
+    adjtime_save_done (save, err);
+    g_clear_error (&err);
+    adjtime_save_free (save);
+}
+
+/* Least squares fit of the offset against the system time. Returns
+ * whether the drift factor was updated. */
+static gboolean
+fit (void)
+{
+    RtcDriftSample *s = (RtcDriftSample *) samples->data;
+    gdouble mean_x = 0, mean_y = 0, sxx = 0, sxy = 0, factor;
+    gint64 x0;
+    guint i, n = samples->len;
+
+    if (n < 2 || s[n - 1].system - s[0].system < MIN_FIT_SPAN)
+        return FALSE;
+
+    /* Relative to the first sample, to keep the precision of doubles */
+    x0 = s[0].system;
+    for (i = 0; i < n; i++) {
+        mean_x += (gdouble) (s[i].system - x0) / G_USEC_PER_SEC;
+        mean_y += (gdouble) s[i].offset / G_USEC_PER_SEC;
+    }
+    mean_x /= n;
+    mean_y /= n;
+    for (i = 0; i < n; i++) {
+        gdouble dx = (gdouble) (s[i].system - x0) / G_USEC_PER_SEC - mean_x;
+        gdouble dy = (gdouble) s[i].offset / G_USEC_PER_SEC - mean_y;
+
+        sxx += dx * dx;
+        sxy += dx * dy;
+    }
+    if (sxx == 0)
+        return FALSE;
+
+    factor = sxy / sxx * SECONDS_PER_DAY;
+    if (ABS (factor) > MAX_DRIFT_FACTOR) {
+        g_warning ("Discarding the rtc drift samples: %f s/day is not plausible, was a clock stepped?", factor);
+        g_array_set_size (samples, 0);
+        return FALSE;
+    }
+
+    g_debug ("rtc drift: %f s/day over %u samples", factor, n);
+    drift_factor = factor;
+    last_calibration = s[n - 1].system;
+    return TRUE;
+}
+
+static void save_if_changed (void);
+
+static void
+save_thread (GTask *task,
+             gpointer source_object,
+             gpointer task_data,
+             GCancellable *cancellable)
+{
+    GError *err = NULL;
+
+    if (adjtime_save_write ((AdjtimeSave *) task_data, &err))
+        g_task_return_boolean (task, TRUE);
+    else
+        g_task_return_error (task, err);
+}
+
+static void
+on_saved_cb (GObject *source_object,
+             GAsyncResult *res,
+             gpointer user_data)
+{
+    GError *err = NULL;
+
+    saving = FALSE;
+    if (!g_task_propagate_boolean (G_TASK (res), &err)) {
+        adjtime_save_done ((AdjtimeSave *) user_data, err);
+        g_error_free (err);
+        return;
+    }
+    adjtime_save_done ((AdjtimeSave *) user_data, NULL);
+    /* The factor may have moved again while the file was written */
+    save_if_changed ();
+}
+
+/* The journal commit flushes to storage, which may take seconds under
+ * load: write in a worker thread */
+static gboolean
+on_save (gpointer user_data)
+{
+    AdjtimeSave *save;
+    GTask *task;
+
+    save_source_id = 0;
+    save = adjtime_save_new ();
+    saving = TRUE;
+    task = g_task_new (NULL, NULL, on_saved_cb, save);
+    g_task_set_task_data (task, save, (GDestroyNotify) adjtime_save_free);
+    g_task_run_in_thread (task, save_thread);
+    g_object_unref (task);
+    return G_SOURCE_REMOVE;
+}
+
+/* Saves once the main loop is idle when the drift factor moved, rather
+ * than from the rtc write which fitted it */
+static void
+save_if_changed (void)
+{
+    if (ABS (drift_factor - saved_factor) < MIN_SAVED_CHANGE || save_source_id != 0 || saving)
+        return;
+    save_source_id = g_idle_add_full (G_PRIORITY_LOW, on_save, NULL, NULL);
+}
+
+static gboolean
+on_timer (gint fd,
+          GIOCondition condition,
+          gpointer user_data)
+{
+    guint64 expirations;
+
+    if (read (fd, &expirations, sizeof (expirations)) < 0) {
+        if (errno != EAGAIN)
+            g_warning ("Unable to read the rtc drift timer: %s", strerror (errno));
+        return G_SOURCE_CONTINUE;
+    }
+
+    if (sample_func != NULL)
+        sample_func (sample_user_data);
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * rtc_drift_init:
+ * @adjtime_filename: the file the drift is loaded from and saved to,
+ * normally /etc/adjtime
+ * @interval: seconds between two periodic samples; 0 disables the drift
+ * tracking, but the drift found in @adjtime_filename is still corrected
+ * @func: starts reading the rtc for periodic samples
+ * @user_data: passed to @func
+ */
+
+void
+rtc_drift_init (const gchar *adjtime_filename,
+                guint interval,
+                RtcDriftSampleFunc func,
+                gpointer user_data)
+{
+    struct itimerspec its;
+
+    adjtime_path = g_strdup (adjtime_filename);
+    sample_func = func;
+    sample_user_data = user_data;
+    samples = g_array_sized_new (FALSE, FALSE, sizeof (RtcDriftSample), MAX_SAMPLES);
+
+    load_adjtime ();
+    /* The rtc was exact when it was last set */
+    if (last_adjust != 0)
+        rtc_drift_add_sample (last_adjust, last_adjust);
+
+    if (interval == 0)
+        return;
+
+    if ((timer_fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+        g_warning ("Unable to create the rtc drift timer: %s", strerror (errno));
+        return;
+    }
+    memset (&its, 0, sizeof (its));
+    its.it_value.tv_sec = interval;
+    its.it_interval.tv_sec = interval;
+    if (timerfd_settime (timer_fd, 0, &its, NULL) < 0) {
+        g_warning ("Unable to arm the rtc drift timer: %s", strerror (errno));
+        close (timer_fd);
+        timer_fd = -1;
+        return;
+    }
+    timer_source_id = g_unix_fd_add (timer_fd, G_IO_IN, on_timer, NULL);
+}
+
+/**
+ * rtc_drift_wants_sample:
+ * @system: the system time
+ *
+ * Returns: whether a sample taken now, before the rtc is set, would
+ * make for a meaningful fit. Taking one costs an rtc read.
+ */
+
+gboolean
+rtc_drift_wants_sample (gint64 system)
+{
+    return timer_fd >= 0 && samples->len > 0 &&
+        system - g_array_index (samples, RtcDriftSample, 0).system >= MIN_FIT_SPAN;
+}
+
+void
+rtc_drift_add_sample (gint64 system,
+                      gint64 rtc)
+{
+    RtcDriftSample s = { system, rtc - system };
+    guint i;
+
+    if (samples->len == MAX_SAMPLES) {
+        for (i = 1; 2 * i < MAX_SAMPLES; i++)
+            g_array_index (samples, RtcDriftSample, i) = g_array_index (samples, RtcDriftSample, 2 * i);
+        g_array_set_size (samples, i);
+    }
+    g_array_append_val (samples, s);
+}
+
+/**
+ * rtc_drift_add_periodic_sample:
+ * @system: the system time
+ * @rtc: the rtc time at @system, not corrected for the drift
+ *
+ * Hands back the reading started by the #RtcDriftSampleFunc, and fits
+ * the drift again.
+ */
+
+void
+rtc_drift_add_periodic_sample (gint64 system,
+                               gint64 rtc)
+{
+    rtc_drift_add_sample (system, rtc);
+    if (fit ())
+        save_if_changed ();
+}
+
+/**
+ * rtc_drift_rtc_set:
+ * @system: the system time the rtc was set to
+ * @local: whether the rtc runs in local time
+ *
+ * To be called after each rtc write. Fits the drift from the samples
+ * taken until then, and starts a new series. /etc/adjtime is only
+ * rewritten when the drift changed, and by #rtc_drift_destroy.
+ */
+
+void
+rtc_drift_rtc_set (gint64 system,
+                   gboolean local)
+{
+    if (timer_fd >= 0 && fit ())
+        save_if_changed ();
+
+    g_array_set_size (samples, 0);
+    last_adjust = system;
+    adjtime_local = local;
+    adjtime_dirty = TRUE;
+    rtc_drift_add_sample (system, system);
+}
+
+/**
+ * rtc_drift_correct:
+ * @rtc: a time read from the rtc
+ *
+ * Returns: @rtc without the drift accumulated since the rtc was set
+ */
+
+gint64
+rtc_drift_correct (gint64 rtc)
+{
+    if (last_adjust == 0 || drift_factor == 0)
+        return rtc;
+    return rtc - (gint64) (drift_factor / SECONDS_PER_DAY * (rtc - last_adjust));
+}
+
+/**
+ * rtc_drift_get_factor:
+ *
+ * Returns: the number of seconds per day the rtc gains
+ */
+
+gdouble
+rtc_drift_get_factor (void)
+{
+    return drift_factor;
+}
+
+/**
+ * rtc_drift_destroy:
+ *
+ * Saves the date of the last rtc write in /etc/adjtime, if it is used,
+ * so that hwclock(8) does not correct from a stale date at boot. Must be
+ * called before #settings_journal_destroy.
+ */
+
+void
+rtc_drift_destroy (void)
+{
+    while (saving)
+        g_main_context_iteration (NULL, TRUE);
+    if (save_source_id != 0) {
+        g_source_remove (save_source_id);
+        save_source_id = 0;
+        adjtime_dirty = TRUE;
+    }
+    if (adjtime_dirty && (timer_fd >= 0 || adjtime_exists))
+        save_adjtime ();
+    if (timer_source_id != 0) {
+        g_source_remove (timer_source_id);
+        timer_source_id = 0;
+    }
+    if (timer_fd >= 0) {
+        close (timer_fd);
+        timer_fd = -1;
+    }
+    g_clear_pointer (&samples, g_array_unref);
+    g_clear_pointer (&adjtime_path, g_free);
+    adjtime_exists = FALSE;
+    adjtime_dirty = FALSE;
+    drift_factor = saved_factor = 0;
+    last_adjust = 0;
+    last_calibration = 0;
+    sample_func = NULL;
+    sample_user_data = NULL;
+}
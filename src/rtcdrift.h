@@ -0,0 +1,82 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _RTC_DRIFT_H_
+#define _RTC_DRIFT_H_
+
+#include <glib.h>
+
+/**
+ * SECTION: rtcdrift
+ * @short_description: Measurement and correction of the rtc drift
+ * @title: RTC drift
+ * @include: rtcdrift.h
+ *
+ * Since the rtc was last set from the system clock, its offset from the
+ * system clock grows at a roughly constant rate. That rate is estimated
+ * by a least squares fit over (system time, rtc time) samples taken
+ * before each rtc write and periodically from a timer, and saved in
+ * /etc/adjtime with the same meaning as hwclock(8) gives it: the number
+ * of seconds per day the rtc gains. Times read from the rtc are corrected
+ * by the drift accumulated since the last write.
+ *
+ * All times are in microseconds since the epoch.
+ */
+
+/**
+ * RtcDriftSampleFunc:
+ * @user_data: the data passed to rtc_drift_init
+ *
+ * Starts reading the rtc for a periodic sample, without waiting for it.
+ * The reading is handed back with #rtc_drift_add_periodic_sample, or
+ * dropped on failure.
+ */
+
+typedef void (*RtcDriftSampleFunc) (gpointer user_data);
+
+void
+rtc_drift_init (const gchar *adjtime_filename,
+                guint interval,
+                RtcDriftSampleFunc func,
+                gpointer user_data);
+
+gboolean
+rtc_drift_wants_sample (gint64 system);
+
+void
+rtc_drift_add_sample (gint64 system,
+                      gint64 rtc);
+
+void
+rtc_drift_add_periodic_sample (gint64 system,
+                               gint64 rtc);
+
+void
+rtc_drift_rtc_set (gint64 system,
+                   gboolean local);
+
+gint64
+rtc_drift_correct (gint64 rtc);
+
+gdouble
+rtc_drift_get_factor (void);
+
+void
+rtc_drift_destroy (void);
+
+#endif
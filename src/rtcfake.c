@@ -0,0 +1,271 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include "rtcfake.h"
+
+#include "config.h"
+
+#define MAX_FAKE_DEVICES 8
+
+typedef struct {
+    gchar *path;
+    gboolean open;
+    gboolean update_irq;
+    /* The rtc read base_rtc at CLOCK_MONOTONIC base_monotonic */
+    gint64 base_rtc;
+    gint64 base_monotonic;
+} RtcFakeDevice;
+
+static RtcFakeParameters parameters;
+static RtcFakeDevice devices[MAX_FAKE_DEVICES];
+static guint n_devices = 0;
+/* The backend functions are called from the rtc mirror threads too */
+static GMutex devices_lock;
+
+static gint64
+device_now (RtcFakeDevice *device)
+{
+    gint64 elapsed = g_get_monotonic_time () - device->base_monotonic;
+
+    return device->base_rtc + elapsed + (gint64) (elapsed * parameters.drift_ppm / 1e6);
+}
+
+/* Sleeps the configured latency, then decides whether the operation
+ * fails */
+static int
+fake_operation (void)
+{
+    if (parameters.latency > 0)
+        g_usleep (parameters.latency);
+    if (parameters.fail_percent > 0 && (guint) g_random_int_range (0, 100) < parameters.fail_percent)
+        return -EIO;
+    return 0;
+}
+
+static RtcFakeDevice *
+lookup_device (int fd)
+{
+    if (fd < 0 || (guint) fd >= n_devices || !devices[fd].open)
+        return NULL;
+    return &devices[fd];
+}
+
+static int
+fake_open (const char *path,
+           int flags)
+{
+    guint i;
+    int r;
+
+    if ((r = fake_operation ()) < 0)
+        return r;
+
+    g_mutex_lock (&devices_lock);
+    for (i = 0; i < n_devices; i++)
+        if (!strcmp (devices[i].path, path))
+            break;
+    if (i == n_devices) {
+        if (n_devices == MAX_FAKE_DEVICES) {
+            r = -ENODEV;
+            goto out;
+        }
+        devices[i].path = g_strdup (path);
+        devices[i].base_rtc = g_get_real_time ();
+        devices[i].base_monotonic = g_get_monotonic_time ();
+        n_devices++;
+    }
+    if (devices[i].open)
+        r = -EBUSY;
+    else {
+        devices[i].open = TRUE;
+        r = i;
+    }
+
+  out:
+    g_mutex_unlock (&devices_lock);
+    return r;
+}
+
+static void
+fake_close (int fd)
+{
+    RtcFakeDevice *device;
+
+    g_mutex_lock (&devices_lock);
+    if ((device = lookup_device (fd)) != NULL) {
+        device->open = FALSE;
+        device->update_irq = FALSE;
+    }
+    g_mutex_unlock (&devices_lock);
+}
+
+static int
+fake_read_time (int fd,
+                struct tm *tm)
+{
+    RtcFakeDevice *device;
+    time_t t;
+    int r;
+
+    if ((r = fake_operation ()) < 0)
+        return r;
+
+    g_mutex_lock (&devices_lock);
+    if ((device = lookup_device (fd)) == NULL)
+        r = -EBADF;
+    else {
+        /* Like RTC_RD_TIME, whatever the rtc holds, as UTC */
+        t = device_now (device) / G_USEC_PER_SEC;
+        gmtime_r (&t, tm);
+    }
+    g_mutex_unlock (&devices_lock);
+    return r;
+}
+
+static int
+fake_set_time (int fd,
+               const struct tm *tm)
+{
+    RtcFakeDevice *device;
+    struct tm copy = *tm;
+    int r;
+
+    if ((r = fake_operation ()) < 0)
+        return r;
+
+    g_mutex_lock (&devices_lock);
+    if ((device = lookup_device (fd)) == NULL)
+        r = -EBADF;
+    else {
+        device->base_rtc = (gint64) timegm (&copy) * G_USEC_PER_SEC;
+        device->base_monotonic = g_get_monotonic_time ();
+    }
+    g_mutex_unlock (&devices_lock);
+    return r;
+}
+
+static int
+fake_update_irq (int fd,
+                 bool enable)
+{
+    RtcFakeDevice *device;
+    int r = 0;
+
+    if (!parameters.update_irq)
+        return -ENOTTY;
+
+    g_mutex_lock (&devices_lock);
+    if ((device = lookup_device (fd)) == NULL)
+        r = -EBADF;
+    else
+        device->update_irq = enable;
+    g_mutex_unlock (&devices_lock);
+    return r;
+}
+
+static int
+fake_wait_update (int fd,
+                  int timeout_ms)
+{
+    RtcFakeDevice *device;
+    gint64 wait;
+    gint64 timeout = (gint64) timeout_ms * G_TIME_SPAN_MILLISECOND;
+
+    g_mutex_lock (&devices_lock);
+    if ((device = lookup_device (fd)) == NULL || !device->update_irq) {
+        g_mutex_unlock (&devices_lock);
+        return -EINVAL;
+    }
+    /* Time to the next rtc second, in system time */
+    wait = G_USEC_PER_SEC - device_now (device) % G_USEC_PER_SEC;
+    wait = (gint64) (wait / (1 + parameters.drift_ppm / 1e6));
+    g_mutex_unlock (&devices_lock);
+
+    if (timeout >= 0 && wait > timeout) {
+        g_usleep (timeout);
+        return 0;
+    }
+    g_usleep (wait);
+    return 1;
+}
+
+static const struct hwclock_backend fake_backend = {
+    .name = "fake",
+    .default_device = "rtcfake0",
+    .open = fake_open,
+    .close = fake_close,
+    .read_time = fake_read_time,
+    .set_time = fake_set_time,
+    .update_irq = fake_update_irq,
+    .wait_update = fake_wait_update,
+};
+
+/**
+ * rtc_fake_init:
+ * @parameters: the behaviour of the fake rtcs
+ *
+ * Returns: the backend to pass to hwclock_set_backend
+ */
+
+const struct hwclock_backend *
+rtc_fake_init (const RtcFakeParameters *_parameters)
+{
+    parameters = *_parameters;
+    g_debug ("Fake rtc: %" G_GUINT64_FORMAT " us latency, %u%% failures, %f ppm drift, %s update interrupt",
+             parameters.latency, parameters.fail_percent, parameters.drift_ppm,
+             parameters.update_irq ? "with" : "without");
+    return &fake_backend;
+}
+
+/**
+ * rtc_fake_advance:
+ * @usec: microseconds of system time
+ *
+ * Moves every fake rtc on as if @usec had passed, drift included, so
+ * that tests can cover hours of rtc time at once.
+ */
+
+void
+rtc_fake_advance (gint64 usec)
+{
+    guint i;
+
+    g_mutex_lock (&devices_lock);
+    for (i = 0; i < n_devices; i++)
+        devices[i].base_monotonic -= usec;
+    g_mutex_unlock (&devices_lock);
+}
+
+void
+rtc_fake_destroy (void)
+{
+    guint i;
+
+    g_mutex_lock (&devices_lock);
+    for (i = 0; i < n_devices; i++)
+        g_free (devices[i].path);
+    memset (devices, 0, sizeof (devices));
+    n_devices = 0;
+    g_mutex_unlock (&devices_lock);
+}
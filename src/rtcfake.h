@@ -0,0 +1,65 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _RTC_FAKE_H_
+#define _RTC_FAKE_H_
+
+#include <glib.h>
+
+#include "copypaste/hwclock.h"
+
+/**
+ * SECTION: rtcfake
+ * @short_description: In-memory rtc devices
+ * @title: Fake RTC
+ * @include: rtcfake.h
+ *
+ * An hwclock backend which keeps its rtcs in memory, for running
+ * timedated on machines without an rtc or without the rights to set
+ * it, and for measuring the rtc paths. Any device path opens a fake
+ * rtc, created on first use from the system time. Like real ones, fake
+ * rtcs can only be opened once at a time, and keep counting from
+ * CLOCK_MONOTONIC when the system clock is set.
+ */
+
+/**
+ * RtcFakeParameters:
+ * @latency: microseconds added to every open, read and write
+ * @fail_percent: share of the opens, reads and writes that fail with EIO
+ * @drift_ppm: how much faster than the system clock the rtcs run, in
+ * parts per million
+ * @update_irq: whether the rtcs have an update interrupt
+ */
+
+typedef struct {
+    guint64 latency;
+    guint fail_percent;
+    gdouble drift_ppm;
+    gboolean update_irq;
+} RtcFakeParameters;
+
+const struct hwclock_backend *
+rtc_fake_init (const RtcFakeParameters *parameters);
+
+void
+rtc_fake_advance (gint64 usec);
+
+void
+rtc_fake_destroy (void);
+
+#endif
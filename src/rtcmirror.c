@@ -0,0 +1,299 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include "copypaste/hwclock.h"
+#include "rtcmirror.h"
+
+#include "config.h"
+
+#define RTC_CLASS_DIR "/sys/class/rtc"
+
+/* Most mirrors written at the same time */
+#define MAX_MIRROR_THREADS 8
+
+typedef struct {
+    gchar *path;
+    /* Serializes writes to the device: rtc devices are single-open */
+    GMutex lock;
+} RtcMirror;
+
+struct mirror_task {
+    RtcMirror *mirror;
+    gboolean local;
+    gboolean accurate;
+    guint64 timeout;
+};
+
+static gchar **configured_mirrors = NULL;
+static GPtrArray *mirrors = NULL;
+static GThreadPool *pool = NULL;
+
+static void
+rtc_mirror_clear (gpointer data)
+{
+    RtcMirror *mirror = data;
+
+    g_free (mirror->path);
+    g_mutex_clear (&mirror->lock);
+}
+
+static void
+rtc_mirror_unref (gpointer data)
+{
+    g_atomic_rc_box_release_full (data, rtc_mirror_clear);
+}
+
+static gchar *
+device_path (const gchar *name)
+{
+    if (g_path_is_absolute (name))
+        return g_strdup (name);
+    return g_build_filename ("/dev", name, NULL);
+}
+
+/* Compares devices through symlinks such as /dev/rtc -> rtc0 */
+static gchar *
+canonical_device (const gchar *path)
+{
+    gchar *canonical = realpath (path, NULL);
+    gchar *ret = g_strdup (canonical != NULL ? canonical : path);
+
+    free (canonical);
+    return ret;
+}
+
+static void
+add_mirror (const gchar *path,
+            const gchar *primary,
+            GHashTable *seen)
+{
+    RtcMirror *mirror;
+    gchar *canonical = canonical_device (path);
+
+    if (!g_strcmp0 (canonical, primary) || g_hash_table_contains (seen, canonical)) {
+        g_free (canonical);
+        return;
+    }
+    g_hash_table_add (seen, canonical);
+
+    mirror = g_atomic_rc_box_new0 (RtcMirror);
+    mirror->path = g_strdup (path);
+    g_mutex_init (&mirror->lock);
+    g_ptr_array_add (mirrors, mirror);
+}
+
+static gint
+compare_names (gconstpointer a,
+               gconstpointer b)
+{
+    return strcmp (*(const gchar * const *) a, *(const gchar * const *) b);
+}
+
+static void
+add_all_mirrors (const gchar *primary,
+                 GHashTable *seen)
+{
+    GDir *dir;
+    GPtrArray *names;
+    const gchar *name;
+    guint i;
+
+    if ((dir = g_dir_open (RTC_CLASS_DIR, 0, NULL)) == NULL)
+        return;
+
+    names = g_ptr_array_new_with_free_func (g_free);
+    while ((name = g_dir_read_name (dir)) != NULL)
+        g_ptr_array_add (names, g_strdup (name));
+    g_dir_close (dir);
+
+    /* Same order on every run */
+    g_ptr_array_sort (names, compare_names);
+    for (i = 0; i < names->len; i++) {
+        gchar *path = device_path (g_ptr_array_index (names, i));
+
+        add_mirror (path, primary, seen);
+        g_free (path);
+    }
+    g_ptr_array_unref (names);
+}
+
+static void
+write_mirror (gpointer data,
+              gpointer user_data)
+{
+    struct mirror_task *task = data;
+    RtcMirror *mirror = task->mirror;
+    gint64 start;
+    int r = -1;
+
+    g_mutex_lock (&mirror->lock);
+    start = g_get_monotonic_time ();
+    if (task->accurate)
+        r = hwclock_set_time_aligned_device (mirror->path, task->local, task->timeout);
+    if (r < 0) {
+        struct timespec ts;
+        struct tm tm;
+
+        clock_gettime (CLOCK_REALTIME, &ts);
+        if (task->local)
+            localtime_r (&ts.tv_sec, &tm);
+        else
+            gmtime_r (&ts.tv_sec, &tm);
+        r = hwclock_set_time_device (mirror->path, &tm);
+    }
+    if (r < 0)
+        g_warning ("Unable to set rtc mirror %s: %s", mirror->path, strerror (-r));
+    else
+        g_debug ("Set rtc mirror %s in %" G_GINT64_FORMAT " us", mirror->path, g_get_monotonic_time () - start);
+    g_mutex_unlock (&mirror->lock);
+
+    rtc_mirror_unref (mirror);
+    g_free (task);
+}
+
+/**
+ * rtc_mirror_refresh:
+ *
+ * Rebuilds the list of mirrors, for instance after an rtc device was
+ * added or removed. Writes in progress complete on the old list.
+ */
+
+void
+rtc_mirror_refresh (void)
+{
+    GHashTable *seen;
+    gchar *primary_path = NULL;
+    gchar *primary = NULL;
+    int r;
+    guint i;
+
+    g_clear_pointer (&mirrors, g_ptr_array_unref);
+    mirrors = g_ptr_array_new_with_free_func (rtc_mirror_unref);
+    if (configured_mirrors == NULL)
+        return;
+
+    if ((r = hwclock_get_device (&primary_path)) < 0)
+        g_debug ("Unable to find the primary rtc: %s", strerror (-r));
+    else {
+        primary = canonical_device (primary_path);
+        free (primary_path);
+    }
+
+    seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    for (i = 0; configured_mirrors[i] != NULL; i++) {
+        if (!g_strcmp0 (configured_mirrors[i], "all"))
+            add_all_mirrors (primary, seen);
+        else {
+            gchar *path = device_path (configured_mirrors[i]);
+
+            add_mirror (path, primary, seen);
+            g_free (path);
+        }
+    }
+    g_hash_table_unref (seen);
+    g_free (primary);
+
+    for (i = 0; i < mirrors->len; i++)
+        g_debug ("rtc mirror: %s", ((RtcMirror *) g_ptr_array_index (mirrors, i))->path);
+}
+
+/**
+ * rtc_mirror_init:
+ * @primary: (nullable): the primary rtc, as a device name such as "rtc0"
+ * or a path; %NULL to let hwclock pick it
+ * @mirrors: (nullable): the devices to keep in sync with the primary one;
+ * "all" stands for every rtc but the primary
+ *
+ * Must be called before any other rtc_mirror function.
+ */
+
+void
+rtc_mirror_init (const gchar *primary,
+                 gchar **_mirrors)
+{
+    GError *err = NULL;
+
+    if (primary != NULL) {
+        gchar *path = device_path (primary);
+
+        hwclock_set_device (path);
+        g_free (path);
+    }
+
+    configured_mirrors = g_strdupv (_mirrors);
+    rtc_mirror_refresh ();
+
+    if (configured_mirrors != NULL) {
+        pool = g_thread_pool_new (write_mirror, NULL, MAX_MIRROR_THREADS, FALSE, &err);
+        if (pool == NULL) {
+            g_warning ("Unable to start rtc mirror threads: %s", err->message);
+            g_error_free (err);
+        }
+    }
+}
+
+/**
+ * rtc_mirror_sync:
+ * @local: whether the rtcs run in local time
+ * @accurate: write on the second boundary, see hwclock_set_time_aligned
+ * @timeout: in microseconds, longest wait for the second boundary
+ *
+ * Queues a write of the system time to every mirror, and returns
+ * without waiting for them.
+ */
+
+void
+rtc_mirror_sync (gboolean local,
+                 gboolean accurate,
+                 guint64 timeout)
+{
+    guint i;
+
+    if (pool == NULL || mirrors == NULL)
+        return;
+
+    for (i = 0; i < mirrors->len; i++) {
+        struct mirror_task *task = g_new0 (struct mirror_task, 1);
+
+        task->mirror = g_atomic_rc_box_acquire (g_ptr_array_index (mirrors, i));
+        task->local = local;
+        task->accurate = accurate;
+        task->timeout = timeout;
+        g_thread_pool_push (pool, task, NULL);
+    }
+}
+
+void
+rtc_mirror_destroy (void)
+{
+    /* Let the queued writes complete */
+    if (pool != NULL) {
+        g_thread_pool_free (pool, FALSE, TRUE);
+        pool = NULL;
+    }
+    g_clear_pointer (&mirrors, g_ptr_array_unref);
+    g_clear_pointer (&configured_mirrors, g_strfreev);
+    hwclock_set_device (NULL);
+}
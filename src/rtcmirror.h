@@ -0,0 +1,53 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _RTC_MIRROR_H_
+#define _RTC_MIRROR_H_
+
+#include <glib.h>
+
+/**
+ * SECTION: rtcmirror
+ * @short_description: Secondary rtc devices kept in sync
+ * @title: RTC mirrors
+ * @include: rtcmirror.h
+ *
+ * Some boards have more than one rtc, for instance one in the SoC and a
+ * battery-backed one on I2C. The primary rtc is the one read and written
+ * by hwclock; the mirrors are written at the same time, each from a
+ * worker thread, so that a slow bus does not delay the D-Bus reply nor
+ * the other devices. Every mirror is set from the system clock at the time
+ * its write runs, and the outcome for each device is logged.
+ */
+
+void
+rtc_mirror_init (const gchar *primary,
+                 gchar **mirrors);
+
+void
+rtc_mirror_refresh (void);
+
+void
+rtc_mirror_sync (gboolean local,
+                 gboolean accurate,
+                 guint64 timeout);
+
+void
+rtc_mirror_destroy (void);
+
+#endif
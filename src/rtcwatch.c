@@ -0,0 +1,133 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "rtcwatch.h"
+
+#include "config.h"
+
+/* Multicast group of the uevents sent by the kernel (udev rebroadcasts
+ * them on group 2, in its own format) */
+#define UEVENT_KERNEL_GROUP 1
+
+static int uevent_fd = -1;
+static guint uevent_source_id = 0;
+static RtcWatchFunc watch_func = NULL;
+static gpointer watch_user_data = NULL;
+
+static gboolean
+on_uevent (gint fd,
+           GIOCondition condition,
+           gpointer user_data)
+{
+    gchar buf[8192];
+    struct sockaddr_nl sender;
+    socklen_t sender_len = sizeof (sender);
+    const gchar *action = NULL, *devpath = NULL, *p;
+    gboolean is_rtc = FALSE;
+    gssize len;
+
+    len = recvfrom (fd, buf, sizeof (buf) - 1, 0, (struct sockaddr *) &sender, &sender_len);
+    if (len < 0) {
+        if (errno != EAGAIN && errno != EINTR && errno != ENOBUFS)
+            g_warning ("Unable to receive uevent: %s", strerror (errno));
+        return G_SOURCE_CONTINUE;
+    }
+    /* Only trust the kernel */
+    if (sender_len != sizeof (sender) || sender.nl_pid != 0)
+        return G_SOURCE_CONTINUE;
+    buf[len] = 0;
+
+    /* "ACTION@DEVPATH\0KEY=VALUE\0KEY=VALUE\0..." */
+    for (p = buf + strlen (buf) + 1; p < buf + len; p += strlen (p) + 1) {
+        if (g_str_has_prefix (p, "ACTION="))
+            action = p + strlen ("ACTION=");
+        else if (g_str_has_prefix (p, "DEVPATH="))
+            devpath = p + strlen ("DEVPATH=");
+        else if (!strcmp (p, "SUBSYSTEM=rtc"))
+            is_rtc = TRUE;
+    }
+
+    if (is_rtc && action != NULL && (!strcmp (action, "add") || !strcmp (action, "remove"))) {
+        g_debug ("rtc device %s: %s", devpath != NULL ? devpath : "(unknown)", action);
+        if (watch_func != NULL)
+            watch_func (action, devpath, watch_user_data);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * rtc_watch_init:
+ * @func: called when an rtc device is added or removed
+ * @user_data: passed to @func
+ *
+ * Start listening to the kernel uevents. Failing to do so is not fatal:
+ * users of the cache still notice vanished devices from ENODEV.
+ */
+
+void
+rtc_watch_init (RtcWatchFunc func,
+                gpointer user_data)
+{
+    struct sockaddr_nl addr;
+
+    watch_func = func;
+    watch_user_data = user_data;
+
+    uevent_fd = socket (AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (uevent_fd < 0) {
+        g_debug ("Unable to listen to uevents: %s", strerror (errno));
+        return;
+    }
+
+    memset (&addr, 0, sizeof (addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = UEVENT_KERNEL_GROUP;
+    if (bind (uevent_fd, (struct sockaddr *) &addr, sizeof (addr)) < 0) {
+        g_debug ("Unable to listen to uevents: %s", strerror (errno));
+        close (uevent_fd);
+        uevent_fd = -1;
+        return;
+    }
+
+    uevent_source_id = g_unix_fd_add (uevent_fd, G_IO_IN, on_uevent, NULL);
+}
+
+void
+rtc_watch_destroy (void)
+{
+    if (uevent_source_id != 0) {
+        g_source_remove (uevent_source_id);
+        uevent_source_id = 0;
+    }
+    if (uevent_fd >= 0) {
+        close (uevent_fd);
+        uevent_fd = -1;
+    }
+    watch_func = NULL;
+    watch_user_data = NULL;
+}
@@ -0,0 +1,47 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _RTC_WATCH_H_
+#define _RTC_WATCH_H_
+
+#include <glib.h>
+
+/**
+ * SECTION: rtcwatch
+ * @short_description: Notification of rtc devices coming and going
+ * @title: RTC watch
+ * @include: rtcwatch.h
+ *
+ * Listens to the kernel uevents (the same notifications udev gets) on
+ * the main loop, and calls back when a device of the rtc subsystem is
+ * added or removed, so that cached device lookups can be invalidated
+ * without rescanning /sys/class/rtc on every access.
+ */
+
+typedef void (*RtcWatchFunc) (const gchar *action,
+                              const gchar *devpath,
+                              gpointer user_data);
+
+void
+rtc_watch_init (RtcWatchFunc func,
+                gpointer user_data);
+
+void
+rtc_watch_destroy (void);
+
+#endif
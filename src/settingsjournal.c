@@ -0,0 +1,638 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "settingsjournal.h"
+
+#include "config.h"
+
+#define JOURNAL_MAGIC "timedated-journal 1"
+
+/* Attempts at finding an unused temporary name next to a target */
+#define STAGE_ATTEMPTS 16
+
+typedef enum {
+    ENTRY_REPLACE,
+    ENTRY_SYMLINK
+} EntryType;
+
+typedef struct {
+    EntryType type;
+    gchar *target;
+    gchar *staged;      /* NULL once renamed over target */
+    gchar *checksum;    /* SHA-256 of the contents, or of the link target */
+} JournalEntry;
+
+struct _SettingsTransaction {
+    GPtrArray *entries;
+    gboolean committed;
+};
+
+static gchar *journal_path = NULL;
+static SettingsDurability durability = SETTINGS_DURABILITY_FULL;
+static GMutex journal_lock;
+
+static guint64 n_commits = 0;
+static gint64 total_commit_usec = 0;
+
+static void
+entry_free (gpointer data)
+{
+    JournalEntry *entry = (JournalEntry *) data;
+
+    g_free (entry->target);
+    g_free (entry->staged);
+    g_free (entry->checksum);
+    g_free (entry);
+}
+
+static void
+set_errno_error (GError **error,
+                 int errsv,
+                 const gchar *action,
+                 const gchar *filename)
+{
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+                 "Unable to %s '%s': %s", action, filename, g_strerror (errsv));
+}
+
+/* Return a new entry for replacing @file, and create its directory */
+static JournalEntry *
+entry_new (EntryType type,
+           GFile *file,
+           GError **error)
+{
+    JournalEntry *entry;
+    g_autofree gchar *dirname = NULL;
+
+    entry = g_new0 (JournalEntry, 1);
+    entry->type = type;
+    entry->target = g_file_get_path (file);
+
+    /* The journal is made of tab separated lines */
+    if (entry->target == NULL || strpbrk (entry->target, "\t\n") != NULL) {
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                     "Unable to journal the replacement of '%s'", entry->target);
+        entry_free (entry);
+        return NULL;
+    }
+
+    dirname = g_path_get_dirname (entry->target);
+    if (g_mkdir_with_parents (dirname, 0755) < 0) {
+        set_errno_error (error, errno, "create directory", dirname);
+        entry_free (entry);
+        return NULL;
+    }
+    return entry;
+}
+
+/* Pick a new temporary name next to @entry's target */
+static void
+entry_next_staged (JournalEntry *entry)
+{
+    g_autofree gchar *dirname = g_path_get_dirname (entry->target);
+    g_autofree gchar *basename = g_path_get_basename (entry->target);
+
+    g_free (entry->staged);
+    entry->staged = g_strdup_printf ("%s/.%s.timedated-%08x", dirname, basename, g_random_int ());
+}
+
+/* Whether the file at @filename is what @entry wants its target to be */
+static gboolean
+entry_matches (JournalEntry *entry,
+               const gchar *filename)
+{
+    struct stat st;
+    g_autofree gchar *contents = NULL;
+    g_autofree gchar *checksum = NULL;
+    gsize length;
+
+    if (filename == NULL || lstat (filename, &st) < 0)
+        return FALSE;
+
+    if (entry->type == ENTRY_SYMLINK) {
+        if (!S_ISLNK (st.st_mode) || (contents = g_file_read_link (filename, NULL)) == NULL)
+            return FALSE;
+        length = strlen (contents);
+    } else if (!S_ISREG (st.st_mode) || !g_file_get_contents (filename, &contents, &length, NULL))
+        return FALSE;
+
+    checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA256, (const guchar *) contents, length);
+    return !g_strcmp0 (checksum, entry->checksum);
+}
+
+static gboolean
+write_all (int fd,
+           const gchar *data,
+           gsize length)
+{
+    while (length > 0) {
+        ssize_t n = write (fd, data, length);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return FALSE;
+        }
+        data += n;
+        length -= n;
+    }
+    return TRUE;
+}
+
+/* Write @length bytes of @data to a new file @filename, with @mode
+ * (subject to the umask) set at creation; flushed by the data policy */
+static gboolean
+write_file (const gchar *filename,
+            int flags,
+            mode_t mode,
+            const gchar *data,
+            gsize length,
+            GError **error)
+{
+    int fd, errsv;
+
+    if ((fd = open (filename, O_WRONLY | O_CREAT | O_CLOEXEC | flags, mode)) < 0) {
+        set_errno_error (error, errno, "create", filename);
+        return FALSE;
+    }
+    if (!write_all (fd, data, length) ||
+        (durability == SETTINGS_DURABILITY_DATA && fdatasync (fd) < 0)) {
+        errsv = errno;
+        close (fd);
+    } else
+        errsv = close (fd) < 0 ? errno : 0;
+    if (errsv != 0) {
+        set_errno_error (error, errsv, "write", filename);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* Flush the directories holding @filenames, each once */
+static gboolean
+sync_parents (GPtrArray *filenames,
+              GError **error)
+{
+    g_autoptr(GHashTable) done = NULL;
+    guint i;
+
+    done = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    for (i = 0; i < filenames->len; i++) {
+        gchar *dirname = g_path_get_dirname (filenames->pdata[i]);
+        int fd, r, errsv;
+
+        if (g_hash_table_contains (done, dirname)) {
+            g_free (dirname);
+            continue;
+        }
+        /* Owned by done from now on */
+        g_hash_table_add (done, dirname);
+        if ((fd = open (dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+            set_errno_error (error, errno, "open directory", dirname);
+            return FALSE;
+        }
+        r = fsync (fd);
+        errsv = errno;
+        close (fd);
+        if (r < 0) {
+            set_errno_error (error, errsv, "sync", dirname);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* Flush @filenames, then the directories holding them. Only these are
+ * written to storage, unlike with syncfs, which would wait for every
+ * dirty page of the file system. A symbolic link has no data of its
+ * own: flushing its directory is enough. */
+static gboolean
+sync_files (GPtrArray *filenames,
+            GError **error)
+{
+    guint i;
+
+    for (i = 0; i < filenames->len; i++) {
+        const gchar *filename = filenames->pdata[i];
+        int fd, r, errsv;
+
+        if ((fd = open (filename, O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) < 0) {
+            if (errno == ELOOP)
+                continue;
+            set_errno_error (error, errno, "open", filename);
+            return FALSE;
+        }
+        r = fdatasync (fd);
+        errsv = errno;
+        close (fd);
+        if (r < 0) {
+            set_errno_error (error, errsv, "sync", filename);
+            return FALSE;
+        }
+    }
+    return sync_parents (filenames, error);
+}
+
+static gchar *
+journal_format (GPtrArray *entries)
+{
+    GString *journal;
+    g_autofree gchar *checksum = NULL;
+    guint i;
+
+    journal = g_string_new (JOURNAL_MAGIC "\n");
+    for (i = 0; i < entries->len; i++) {
+        JournalEntry *entry = entries->pdata[i];
+
+        g_string_append_printf (journal, "%s\t%s\t%s\t%s\n",
+                                entry->type == ENTRY_SYMLINK ? "symlink" : "replace",
+                                entry->checksum, entry->staged, entry->target);
+    }
+    checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA256, (const guchar *) journal->str, journal->len);
+    g_string_append_printf (journal, "commit\t%s\n", checksum);
+    return g_string_free (journal, FALSE);
+}
+
+/* Return the entries recorded in @journal; @complete is set if they are
+ * followed by a matching commit record */
+static GPtrArray *
+journal_parse (const gchar *journal,
+               gboolean *complete)
+{
+    GPtrArray *entries;
+    const gchar *line, *end;
+
+    entries = g_ptr_array_new_with_free_func (entry_free);
+    *complete = FALSE;
+    if (!g_str_has_prefix (journal, JOURNAL_MAGIC "\n"))
+        return entries;
+
+    for (line = journal + strlen (JOURNAL_MAGIC "\n"); (end = strchr (line, '\n')) != NULL; line = end + 1) {
+        g_autofree gchar *text = g_strndup (line, end - line);
+        g_auto(GStrv) fields = g_strsplit (text, "\t", 0);
+        guint n_fields = g_strv_length (fields);
+        JournalEntry *entry;
+
+        if (n_fields == 2 && !strcmp (fields[0], "commit")) {
+            g_autofree gchar *checksum = NULL;
+
+            checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA256, (const guchar *) journal, line - journal);
+            *complete = !strcmp (checksum, fields[1]);
+            break;
+        }
+        if (n_fields != 4 || (strcmp (fields[0], "replace") && strcmp (fields[0], "symlink")))
+            break;
+
+        entry = g_new0 (JournalEntry, 1);
+        entry->type = strcmp (fields[0], "symlink") ? ENTRY_REPLACE : ENTRY_SYMLINK;
+        entry->checksum = g_strdup (fields[1]);
+        entry->staged = g_strdup (fields[2]);
+        entry->target = g_strdup (fields[3]);
+        g_ptr_array_add (entries, entry);
+    }
+    return entries;
+}
+
+/* Complete or roll back the transaction left in the journal, if any. Must
+ * be called with journal_lock held. */
+static void
+journal_replay (void)
+{
+    g_autofree gchar *journal = NULL;
+    g_autoptr(GPtrArray) entries = NULL;
+    g_autoptr(GPtrArray) targets = NULL;
+    GError *err = NULL;
+    gboolean complete;
+    guint i;
+
+    if (!g_file_get_contents (journal_path, &journal, NULL, &err)) {
+        if (!g_error_matches (err, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            g_warning ("Unable to read the settings journal: %s", err->message);
+        g_error_free (err);
+        return;
+    }
+
+    /* Only a transaction whose every file made it through the barrier may
+     * be completed. Renames start after the barrier, so a target matching
+     * its checksum implies the other staged files are intact too. */
+    entries = journal_parse (journal, &complete);
+    for (i = 0; complete && i < entries->len; i++) {
+        JournalEntry *entry = entries->pdata[i];
+
+        if (entry_matches (entry, entry->staged))
+            continue;
+        if (entry_matches (entry, entry->target))
+            g_clear_pointer (&entry->staged, g_free);
+        else
+            complete = FALSE;
+    }
+
+    targets = g_ptr_array_new ();
+    for (i = 0; i < entries->len; i++) {
+        JournalEntry *entry = entries->pdata[i];
+
+        if (entry->staged == NULL)
+            continue;
+        if (!complete)
+            g_unlink (entry->staged);
+        else if (rename (entry->staged, entry->target) < 0)
+            g_warning ("Unable to rename '%s' to '%s': %s", entry->staged, entry->target, g_strerror (errno));
+        else
+            g_ptr_array_add (targets, entry->target);
+    }
+
+    if (complete) {
+        if (durability == SETTINGS_DURABILITY_FULL && !sync_parents (targets, &err)) {
+            g_warning ("%s", err->message);
+            g_clear_error (&err);
+        }
+        g_message ("Completed an interrupted settings transaction of %u files", entries->len);
+    } else
+        g_message ("Rolled back an interrupted settings transaction");
+
+    g_unlink (journal_path);
+}
+
+/**
+ * settings_journal_init:
+ * @journal_filename: where to keep the journal; it should be on persistent
+ * storage
+ * @policy: how much to flush, for every transaction
+ *
+ * Completes or rolls back the transaction left by an interrupted commit.
+ * Until this is called, commits fail.
+ */
+
+void
+settings_journal_init (const gchar *journal_filename,
+                       SettingsDurability policy)
+{
+    g_autofree gchar *dirname = NULL;
+
+    journal_path = g_strdup (journal_filename);
+    durability = policy;
+    dirname = g_path_get_dirname (journal_path);
+    if (g_mkdir_with_parents (dirname, 0755) < 0)
+        g_warning ("Unable to create directory '%s': %s", dirname, g_strerror (errno));
+
+    g_mutex_lock (&journal_lock);
+    journal_replay ();
+    g_mutex_unlock (&journal_lock);
+}
+
+void
+settings_journal_destroy (void)
+{
+    if (n_commits > 0)
+        g_debug ("%" G_GUINT64_FORMAT " settings transactions committed in %" G_GINT64_FORMAT " us on average",
+                 n_commits, total_commit_usec / (gint64) n_commits);
+    g_clear_pointer (&journal_path, g_free);
+    durability = SETTINGS_DURABILITY_FULL;
+    n_commits = 0;
+    total_commit_usec = 0;
+}
+
+SettingsTransaction *
+settings_transaction_new (void)
+{
+    SettingsTransaction *transaction;
+
+    transaction = g_new0 (SettingsTransaction, 1);
+    transaction->entries = g_ptr_array_new_with_free_func (entry_free);
+    return transaction;
+}
+
+/**
+ * settings_transaction_replace:
+ * @transaction: the transaction
+ * @file: the file to replace
+ * @contents: its new contents
+ * @length: the length of @contents
+ * @mode: its new permissions, subject to the umask
+ * @error: set if the new contents could not be staged
+ *
+ * Stages the new contents of @file; they only replace @file on
+ * #settings_transaction_commit.
+ *
+ * Returns: %FALSE in case of error
+ */
+
+gboolean
+settings_transaction_replace (SettingsTransaction *transaction,
+                              GFile *file,
+                              const gchar *contents,
+                              gsize length,
+                              mode_t mode,
+                              GError **error)
+{
+    JournalEntry *entry;
+    GError *err = NULL;
+    guint attempt;
+
+    g_return_val_if_fail (!transaction->committed, FALSE);
+
+    if ((entry = entry_new (ENTRY_REPLACE, file, error)) == NULL)
+        return FALSE;
+
+    for (attempt = 0; attempt < STAGE_ATTEMPTS; attempt++) {
+        g_clear_error (&err);
+        entry_next_staged (entry);
+        if (write_file (entry->staged, O_EXCL, mode, contents, length, &err) ||
+            !g_error_matches (err, G_FILE_ERROR, G_FILE_ERROR_EXIST))
+            break;
+    }
+    if (err != NULL) {
+        /* Written partially or not at all */
+        if (!g_error_matches (err, G_FILE_ERROR, G_FILE_ERROR_EXIST))
+            g_unlink (entry->staged);
+        g_propagate_error (error, err);
+        entry_free (entry);
+        return FALSE;
+    }
+
+    entry->checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA256, (const guchar *) contents, length);
+    g_ptr_array_add (transaction->entries, entry);
+    return TRUE;
+}
+
+/**
+ * settings_transaction_symlink:
+ * @transaction: the transaction
+ * @file: the file to replace
+ * @target: where the new symbolic link should point to
+ * @error: set if the link could not be staged
+ *
+ * Stages a symbolic link to @target; it only replaces @file on
+ * #settings_transaction_commit.
+ *
+ * Returns: %FALSE in case of error
+ */
+
+gboolean
+settings_transaction_symlink (SettingsTransaction *transaction,
+                              GFile *file,
+                              const gchar *target,
+                              GError **error)
+{
+    JournalEntry *entry;
+    guint attempt;
+    int r = -1;
+
+    g_return_val_if_fail (!transaction->committed, FALSE);
+
+    if ((entry = entry_new (ENTRY_SYMLINK, file, error)) == NULL)
+        return FALSE;
+
+    for (attempt = 0; r < 0 && attempt < STAGE_ATTEMPTS; attempt++) {
+        entry_next_staged (entry);
+        if ((r = symlink (target, entry->staged)) < 0 && errno != EEXIST)
+            break;
+    }
+    if (r < 0) {
+        set_errno_error (error, errno, "create symlink", entry->staged);
+        entry_free (entry);
+        return FALSE;
+    }
+
+    entry->checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA256, target, -1);
+    g_ptr_array_add (transaction->entries, entry);
+    return TRUE;
+}
+
+/**
+ * settings_transaction_commit:
+ * @transaction: the transaction
+ * @error: set if the transaction could not be committed
+ *
+ * Replaces all the files staged in @transaction. On failure before the
+ * barrier, no file is replaced. On failure after it, the journal is kept
+ * so that the transaction is completed at the next start.
+ *
+ * Returns: %FALSE in case of error
+ */
+
+gboolean
+settings_transaction_commit (SettingsTransaction *transaction,
+                             GError **error)
+{
+    g_autofree gchar *journal = NULL;
+    g_autoptr(GPtrArray) filenames = NULL;
+    gint64 start, barrier, end;
+    gboolean ret = FALSE;
+    guint i;
+
+    g_return_val_if_fail (!transaction->committed, FALSE);
+
+    if (transaction->entries->len == 0) {
+        transaction->committed = TRUE;
+        return TRUE;
+    }
+    if (journal_path == NULL) {
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_PERM, "Settings are read-only");
+        return FALSE;
+    }
+
+    g_mutex_lock (&journal_lock);
+    start = g_get_monotonic_time ();
+
+    /* A journal from a failed commit must not be overwritten unreplayed */
+    journal_replay ();
+
+    journal = journal_format (transaction->entries);
+    if (!write_file (journal_path, O_TRUNC, 0600, journal, strlen (journal), error))
+        goto rollback;
+
+    /* The barrier: the journal and the staged files are flushed together
+     * before any of them is renamed. With the data policy the files were
+     * flushed one by one as they were written. */
+    filenames = g_ptr_array_new ();
+    g_ptr_array_add (filenames, journal_path);
+    for (i = 0; i < transaction->entries->len; i++)
+        g_ptr_array_add (filenames, ((JournalEntry *) transaction->entries->pdata[i])->staged);
+    if (durability == SETTINGS_DURABILITY_FULL && !sync_files (filenames, error))
+        goto rollback;
+    barrier = g_get_monotonic_time ();
+
+    /* Past this point the transaction is complete, even if we crash */
+    transaction->committed = TRUE;
+    g_ptr_array_set_size (filenames, 0);
+    for (i = 0; i < transaction->entries->len; i++) {
+        JournalEntry *entry = transaction->entries->pdata[i];
+
+        if (rename (entry->staged, entry->target) < 0) {
+            set_errno_error (error, errno, "replace", entry->target);
+            g_prefix_error (error, "Settings will be completed at the next start: ");
+            goto out;
+        }
+        g_clear_pointer (&entry->staged, g_free);
+        g_ptr_array_add (filenames, entry->target);
+    }
+    if (durability == SETTINGS_DURABILITY_FULL && !sync_parents (filenames, error)) {
+        g_prefix_error (error, "Settings will be completed at the next start: ");
+        goto out;
+    }
+    g_unlink (journal_path);
+
+    end = g_get_monotonic_time ();
+    n_commits++;
+    total_commit_usec += end - start;
+    g_debug ("Committed %u settings files in %" G_GINT64_FORMAT " us (%" G_GINT64_FORMAT " us to the barrier)",
+             transaction->entries->len, end - start, barrier - start);
+    ret = TRUE;
+    goto out;
+
+  rollback:
+    g_unlink (journal_path);
+
+  out:
+    g_mutex_unlock (&journal_lock);
+    return ret;
+}
+
+/**
+ * settings_transaction_free:
+ * @transaction: the transaction
+ *
+ * Frees @transaction, discarding the staged files if it was not
+ * committed.
+ */
+
+void
+settings_transaction_free (SettingsTransaction *transaction)
+{
+    guint i;
+
+    if (transaction == NULL)
+        return;
+
+    for (i = 0; !transaction->committed && i < transaction->entries->len; i++)
+        g_unlink (((JournalEntry *) transaction->entries->pdata[i])->staged);
+    g_ptr_array_unref (transaction->entries);
+    g_free (transaction);
+}
@@ -0,0 +1,101 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _SETTINGS_JOURNAL_H_
+#define _SETTINGS_JOURNAL_H_
+
+#include <sys/types.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+/**
+ * SECTION: settingsjournal
+ * @short_description: Crash consistent replacement of several settings files
+ * @title: Settings journal
+ * @include: settingsjournal.h
+ *
+ * A transaction stages the new contents of each file it replaces next to
+ * the file, under a temporary name. On commit, an intent journal listing
+ * the staged files and their checksums is written, then a single barrier
+ * (an fdatasync of the journal and of each staged file, then an fsync of
+ * their directories) makes them durable together, and only then are the
+ * staged files renamed over their targets. Once the renames are durable
+ * the journal is removed.
+ *
+ * At startup, a leftover journal is replayed if its commit record is
+ * intact and every staged file (or its already renamed target) matches
+ * its checksum; otherwise the transaction is rolled back by deleting the
+ * staged files, leaving every target as it was.
+ *
+ * How much is flushed to storage on the way is set by the
+ * #SettingsDurability policy, the same for every file.
+ */
+
+/**
+ * SettingsDurability:
+ * @SETTINGS_DURABILITY_NONE: nothing is flushed; a crash of the daemon
+ * leaves consistent files, a power loss may not
+ * @SETTINGS_DURABILITY_DATA: the journal and each staged file are
+ * fdatasync'ed as they are written, so that no file is replaced by
+ * partial contents; the renames are not flushed
+ * @SETTINGS_DURABILITY_FULL: the journal and the staged files are flushed
+ * by a single barrier, and the directories are fsync'ed after the
+ * renames, so a committed transaction stays committed
+ */
+
+typedef enum {
+    SETTINGS_DURABILITY_NONE,
+    SETTINGS_DURABILITY_DATA,
+    SETTINGS_DURABILITY_FULL
+} SettingsDurability;
+
+typedef struct _SettingsTransaction SettingsTransaction;
+
+void
+settings_journal_init (const gchar *journal_filename,
+                       SettingsDurability durability);
+
+void
+settings_journal_destroy (void);
+
+SettingsTransaction *
+settings_transaction_new (void);
+
+gboolean
+settings_transaction_replace (SettingsTransaction *transaction,
+                              GFile *file,
+                              const gchar *contents,
+                              gsize length,
+                              mode_t mode,
+                              GError **error);
+
+gboolean
+settings_transaction_symlink (SettingsTransaction *transaction,
+                              GFile *file,
+                              const gchar *target,
+                              GError **error);
+
+gboolean
+settings_transaction_commit (SettingsTransaction *transaction,
+                             GError **error);
+
+void
+settings_transaction_free (SettingsTransaction *transaction);
+
+#endif
@@ -612,6 +612,28 @@ DEBUG end */
 DEBUG end */
 }
 
+/**
+ * shell_parser_to_string:
+ * @parser: parser to serialize
+ *
+ * Returns the contents #shell_parser_save would write to the file.
+ *
+ * Returns: a newly allocated string, free with g_free()
+ */
+
+gchar *
+shell_parser_to_string (ShellParser *parser)
+{
+    GString *contents;
+    GList *curr = NULL;
+
+    g_assert (parser != NULL);
+    contents = g_string_new (NULL);
+    for (curr = parser->entry_list; curr != NULL; curr = curr->next)
+        g_string_append (contents, ((struct ShellEntry *)(curr->data))->string);
+    return g_string_free (contents, FALSE);
+}
+
 /**
  * shell_parser_save:
  * @parser: parser to write back to its file
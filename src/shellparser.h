@@ -100,6 +100,9 @@ void
 shell_parser_clear_variable (ShellParser *parser,
                              const gchar *variable);
 
+gchar *
+shell_parser_to_string (ShellParser *parser);
+
 gboolean
 shell_parser_save (ShellParser *parser,
                    GError **error);
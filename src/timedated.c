@@ -25,6 +25,8 @@
 #include <string.h>
 #include <time.h>
 
+#include <sys/timex.h>
+
 #include <dbus/dbus-protocol.h>
 #include <glib.h>
 #include <glib/gstdio.h>
@@ -34,8 +36,21 @@
 #include <rc.h>
 #endif
 
+#include "clockstep.h"
+#include "clockthread.h"
+#include "clockwatch.h"
+#include "asynclock.h"
 #include "copypaste/hwclock.h"
+#include "dstwatch.h"
+#include "ratelimit.h"
+#include "rtcdrift.h"
+#include "rtcfake.h"
+#include "rtcmirror.h"
+#include "rtcwatch.h"
+#include "settingsjournal.h"
 #include "timedated.h"
+#include "tzcatalog.h"
+#include "tzfile.h"
 #include "timedate1-generated.h"
 #include "main.h"
 #include "utils.h"
@@ -52,16 +67,88 @@ static GFile *timezone_file = NULL;
 static GFile *localtime_file = NULL;
 
 #define ZONEINFODIR DATADIR "/zoneinfo"
+#define TZCATALOG_CACHE LOCALSTATEDIR "/cache/timedated/timezones"
+#define SETTINGS_JOURNAL LOCALSTATEDIR "/lib/timedated/settings.journal"
+
+static TzCatalog *tz_catalog = NULL;
+
+/* Most instants accepted by a single GetTimezoneOffsets call */
+#define MAX_OFFSET_QUERIES 65536
 
 gboolean local_rtc = FALSE;
 gchar *timezone_name = NULL;
-G_LOCK_DEFINE_STATIC (clock);
+
+/* Taken in this order, which is the order they are created in; see
+ * asynclock.h. The time zone, localtime and hwclock files, along with
+ * timezone_name and local_rtc: */
+static AsyncLock *zone_lock = NULL;
+/* The system clock and the rtcs: */
+static AsyncLock *clock_lock = NULL;
+/* The ntp service, along with use_ntp: */
+static AsyncLock *ntp_lock = NULL;
+
+/* Setting and reading the clock go ahead of the configuration work queued
+ * for the same locks, whose file writes and service switches can take
+ * seconds */
+#define CLOCK_PRIORITY G_PRIORITY_HIGH
+#define CONFIG_PRIORITY G_PRIORITY_DEFAULT
+
+/* Time the methods spent waiting for their locks */
+typedef enum {
+    WAIT_SET_TIME,
+    WAIT_GET_TIME_INFO,
+    WAIT_SET_TIMEZONE,
+    WAIT_SET_LOCAL_RTC,
+    WAIT_SET_NTP,
+    WAIT_APPLY_SETTINGS,
+    N_WAITS
+} QueueWait;
+
+static const gchar * const queue_wait_methods[N_WAITS] = {
+    "SetTime",
+    "GetTimeInfo",
+    "SetTimezone",
+    "SetLocalRTC",
+    "SetNTP",
+    "ApplySettings",
+};
+
+static struct {
+    guint64 calls;
+    gint64 max;
+    gint64 total;
+} queue_waits[N_WAITS];
+
+/* Read and write the rtc on its second boundary, see rtcaccurate and
+ * rtctimeout in timedated.conf */
+#define DEFAULT_RTC_TIMEOUT_MSEC 1500
+#define MAX_RTC_TIMEOUT_MSEC 10000
+
+#define ADJTIME SYSCONFDIR "/adjtime"
+/* Bounds of rtcdriftinterval, in seconds; 0 disables the drift tracking */
+#define MIN_RTC_DRIFT_INTERVAL 60
+#define MAX_RTC_DRIFT_INTERVAL (7 * 24 * 3600)
+static gboolean rtc_accurate = FALSE;
+
+/* Reads of the rtc for RTCTimeUSec, see get_rtc_time_cached */
+#define RTC_CACHE_USEC (2 * G_USEC_PER_SEC)
+static gboolean rtc_cache_valid = FALSE;
+static gint64 rtc_cache_value = -1;
+static gint64 rtc_cache_monotonic = 0;
+
+/* CLOCK_REALTIME - CLOCK_MONOTONIC right after timedated stepped the
+ * clock itself and took care of the rtc, see clock_step_locked. The two
+ * clocks are not read at once; a step smaller than the tolerance would
+ * not change the rtc, which has a one second resolution, anyway. */
+#define OWN_STEP_TOLERANCE (10 * G_TIME_SPAN_MILLISECOND)
+static gboolean own_step_pending = FALSE;
+static gint64 own_step_offset = 0;
+static guint64 rtc_timeout = DEFAULT_RTC_TIMEOUT_MSEC * G_TIME_SPAN_MILLISECOND;
 
 gboolean use_ntp = FALSE;
 static const gchar *ntp_preferred_service = NULL;
 static const gchar *ntp_default_services[] = { "ntpd", "chronyd", "busybox-ntpd", NULL };
 #define NTP_DEFAULT_SERVICES_PACKAGES "ntp, openntpd, chrony, busybox-ntpd"
-G_LOCK_DEFINE_STATIC (ntp);
 
 static gboolean
 get_local_rtc (GError **error)
@@ -84,8 +171,41 @@ get_timezone_name (GError **error)
     return g_strdup (g_time_zone_get_identifier (tz));
 }
 
+/* Return the up to date time zone catalog, or NULL if none could be built;
+ * return value should NOT be freed */
+static TzCatalog *
+get_tz_catalog (void)
+{
+    GError *err = NULL;
+
+    if (tz_catalog != NULL && !tz_catalog_is_stale (tz_catalog))
+        return tz_catalog;
+
+    g_clear_pointer (&tz_catalog, tz_catalog_free);
+    if ((tz_catalog = tz_catalog_new (ZONEINFODIR, TZCATALOG_CACHE, &err)) == NULL) {
+        g_warning ("%s", err->message);
+        g_clear_error (&err);
+    }
+    return tz_catalog;
+}
+
+/* Return the zone @identifier is a backward compatible alias for, or
+ * @identifier itself if it is a zone of its own or unknown; return value
+ * should NOT be freed */
+static const gchar *
+canonical_timezone (const gchar *identifier)
+{
+    TzCatalog *catalog;
+    const gchar *canonical = NULL;
+
+    if ((catalog = get_tz_catalog ()) != NULL)
+        canonical = tz_catalog_canonicalize (catalog, identifier);
+    return canonical != NULL ? canonical : identifier;
+}
+
 static gboolean
 set_timezone_file (const gchar *identifier,
+                   SettingsTransaction *transaction,
                    GError **error)
 {
     g_autofree gchar *timezone_filename = NULL;
@@ -99,56 +219,42 @@ set_timezone_file (const gchar *identifier,
         return TRUE;
 
     timezone_filename = g_file_get_path (timezone_file);
-    if (!g_file_replace_contents (timezone_file, identifier, strlen (identifier),
-                                  NULL, FALSE, 0, NULL, NULL, error)) {
+    if (!settings_transaction_replace (transaction, timezone_file, identifier, strlen (identifier), 0644, error)) {
         g_prefix_error (error, "Unable to write '%s':", timezone_filename);
         return FALSE;
     }
-    if(g_chmod (timezone_filename, 0664) != 0) {
-        g_set_error (error, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED, "Unable to set 0664 permissions on timezone file '%s'", timezone_filename);
-    }
 
     return TRUE;
 }
 
 static gboolean
 set_localtime_file (const gchar *identifier,
+                    SettingsTransaction *transaction,
                     GError **error)
 {
-    g_autofree gchar *filebuf = NULL, *localtime_filename = NULL, *identifier_filename = NULL;
-    g_autoptr(GFile) identifier_file = NULL;
-    gsize length = 0;
+    g_autofree gchar *localtime_filename = NULL, *identifier_filename = NULL;
+    g_autoptr(GMappedFile) zone = NULL;
 
     g_return_val_if_fail (error != NULL, FALSE);
 
     localtime_filename = g_file_get_path (localtime_file);
     identifier_filename = g_strdup_printf (ZONEINFODIR "/%s", identifier);
-    identifier_file = g_file_new_for_path (identifier_filename);
 
-    if (g_file_test(localtime_filename, G_FILE_TEST_IS_SYMLINK)) {
-        if (!g_file_delete (localtime_file, NULL, error)) {
-            g_prefix_error (error, "Unable to delete file to make new symlink %s:", localtime_filename);
-            return FALSE;
-        }
-        if (!g_file_make_symbolic_link (localtime_file, identifier_filename, NULL, error)) {
-            g_prefix_error (error, "Unable to create symlink %s -> %s:", localtime_filename, identifier_filename);
-            return FALSE;
-        }
-    } else if (g_file_test(localtime_filename, G_FILE_TEST_IS_REGULAR)) {
-        if (!g_file_load_contents (identifier_file, NULL, &filebuf, &length, NULL, error)) {
+    if (g_file_test(localtime_filename, G_FILE_TEST_IS_REGULAR) &&
+        !g_file_test(localtime_filename, G_FILE_TEST_IS_SYMLINK)) {
+        if ((zone = g_mapped_file_new (identifier_filename, FALSE, error)) == NULL) {
             g_prefix_error (error, "Unable to read '%s':", identifier_filename);
             return FALSE;
         }
-        if (!g_file_replace_contents (localtime_file, filebuf, length, NULL, FALSE, 0, NULL, NULL, error)) {
+        if (!settings_transaction_replace (transaction, localtime_file,
+                                           g_mapped_file_get_contents (zone), g_mapped_file_get_length (zone),
+                                           0644, error)) {
             g_prefix_error (error, "Unable to write '%s':", localtime_filename);
             return FALSE;
         }
-        if(g_chmod (localtime_filename, 0664) != 0) {
-            g_set_error (error, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED, "Unable to set 0664 permissions on localtime file '%s'", localtime_filename);
-        }
     } else {
-        // File doesn't exist yet -> make a new symlink
-        if (!g_file_make_symbolic_link (localtime_file, identifier_filename, NULL, error)) {
+        // Symlink, or file doesn't exist yet -> make a new symlink
+        if (!settings_transaction_symlink (transaction, localtime_file, identifier_filename, error)) {
             g_prefix_error (error, "Unable to create symlink %s -> %s:", localtime_filename, identifier_filename);
             return FALSE;
         }
@@ -156,16 +262,19 @@ set_localtime_file (const gchar *identifier,
 
     return TRUE;
 }
+
+/* Stage the time zone files in @transaction */
 static gboolean
 set_timezone (const gchar *identifier,
+              SettingsTransaction *transaction,
               GError **error)
 {
-    if (!set_timezone_file (identifier, error)) {
+    if (!set_timezone_file (identifier, transaction, error)) {
         g_autofree gchar *timezone_filename = g_file_get_path (timezone_file);
         g_debug ("Error setting %s: %s", timezone_filename, (*error)->message);
         g_clear_error (error);
     }
-    if (!set_localtime_file (identifier, error))
+    if (!set_localtime_file (identifier, transaction, error))
         return FALSE;
 
     return TRUE;
@@ -329,323 +438,1553 @@ service_enable (const gchar *service,
 #endif
 }
 
-struct invoked_set_time {
-    GDBusMethodInvocation *invocation;
-    gint64 usec_utc;
-    gboolean relative;
-};
+/* Runs the rc script of @service, which may take seconds */
+static gboolean
+switch_ntp_service (const gchar *service,
+                    gboolean enable,
+                    GError **error)
+{
+    if (enable)
+        return service_enable (service, error);
+    else
+        return service_disable (service, error);
+}
 
-static void
-on_handle_set_time_authorized_cb (GObject *source_object,
-                                  GAsyncResult *res,
-                                  gpointer user_data)
+static gboolean
+config_get_boolean (GKeyFile *config,
+                    const gchar *key,
+                    gboolean default_value)
 {
     GError *err = NULL;
-    struct invoked_set_time *data;
-    struct timespec ts = { 0, 0 };
-    struct tm *tm = NULL;
+    gboolean value;
 
-    data = (struct invoked_set_time *) user_data;
-    if (!check_polkit_finish (res, &err)) {
-        g_dbus_method_invocation_return_gerror (data->invocation, err);
-        goto out;
+    if (config == NULL)
+        return default_value;
+    value = g_key_file_get_boolean (config, "settings", key, &err);
+    if (err != NULL) {
+        if (!g_error_matches (err, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND) &&
+            !g_error_matches (err, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_GROUP_NOT_FOUND))
+            g_warning ("Ignoring %s in configuration: %s", key, err->message);
+        g_error_free (err);
+        return default_value;
     }
+    return value;
+}
 
-    G_LOCK (clock);
-    if (!data->relative && data->usec_utc < 0) {
-        g_dbus_method_invocation_return_dbus_error (data->invocation, DBUS_ERROR_INVALID_ARGS, "Attempt to set time before epoch");
-        goto unlock;
+static gint
+config_get_integer (GKeyFile *config,
+                    const gchar *key,
+                    gint default_value,
+                    gint min,
+                    gint max)
+{
+    GError *err = NULL;
+    gint value;
+
+    if (config == NULL)
+        return default_value;
+    value = g_key_file_get_integer (config, "settings", key, &err);
+    if (err != NULL) {
+        if (!g_error_matches (err, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND) &&
+            !g_error_matches (err, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_GROUP_NOT_FOUND))
+            g_warning ("Ignoring %s in configuration: %s", key, err->message);
+        g_error_free (err);
+        return default_value;
     }
+    if (value < min || value > max) {
+        g_warning ("Ignoring %s in configuration: %d is not between %d and %d", key, value, min, max);
+        return default_value;
+    }
+    return value;
+}
 
-    if (data->relative)
-        if (clock_gettime (CLOCK_REALTIME, &ts)) {
-            int errsv = errno;
-            g_dbus_method_invocation_return_dbus_error (data->invocation, DBUS_ERROR_FAILED, strerror (errsv));
-            goto unlock;
-        }
-    ts.tv_sec += data->usec_utc / 1000000;
-    ts.tv_nsec += (data->usec_utc % 1000000) * 1000;
-    if (clock_settime (CLOCK_REALTIME, &ts)) {
-        int errsv = errno;
-        g_dbus_method_invocation_return_dbus_error (data->invocation, DBUS_ERROR_FAILED, strerror (errsv));
-        goto unlock;
+/* Must be called with the clock lock held. When @accurate, the rtc
+ * time is the one at the moment of return, sub-second part included.
+ * Returns the rtc time in microseconds, or -1 on failure. */
+static gint64
+read_rtc_raw (gboolean local,
+              gboolean accurate)
+{
+    struct tm tm;
+    guint64 edge = 0;
+    gint64 elapsed = 0;
+    time_t t;
+    int r = -1;
+
+    memset (&tm, 0, sizeof (tm));
+    if (accurate) {
+        r = hwclock_get_time_aligned (&tm, rtc_timeout, &edge);
+        if (r >= 0)
+            /* g_get_monotonic_time is CLOCK_MONOTONIC in microseconds too */
+            elapsed = g_get_monotonic_time () - (gint64) edge;
+        else
+            g_debug ("Unable to read the rtc on a second boundary, reading it directly: %s", strerror (-r));
     }
+    if (r < 0 && hwclock_get_time (&tm) < 0)
+        return -1;
 
-    if (local_rtc)
-        tm = localtime(&ts.tv_sec);
+    if (local)
+        t = mktime (&tm);
     else
-        tm = gmtime(&ts.tv_sec);
-    hwclock_set_time(tm);
-
-    timedated_timedate1_complete_set_time (timedate1, data->invocation);
-
-  unlock:
-    G_UNLOCK (clock);
-
-  out:
-    g_free (data);
-    if (err != NULL)
-        g_error_free (err);
+        t = timegm (&tm);
+    return (gint64) t * G_USEC_PER_SEC + elapsed;
 }
 
+/* Same as read_rtc_raw, corrected for the rtc drift */
 static gboolean
-on_handle_set_time (TimedatedTimedate1 *timedate1,
-                    GDBusMethodInvocation *invocation,
-                    const gint64 usec_utc,
-                    const gboolean relative,
-                    const gboolean user_interaction,
-                    gpointer user_data)
+read_rtc (gboolean local,
+          struct timespec *ts)
 {
-    if (read_only)
-        g_dbus_method_invocation_return_dbus_error (invocation,
-                                                    DBUS_ERROR_NOT_SUPPORTED,
-                                                    SERVICE_NAME " is in read-only mode");
-    else {
-        struct invoked_set_time *data;
-        data = g_new0 (struct invoked_set_time, 1);
-        data->invocation = invocation;
-        data->usec_utc = usec_utc;
-        data->relative = relative;
-        check_polkit_async (g_dbus_method_invocation_get_sender (invocation), "org.freedesktop.timedate1.set-time", user_interaction, on_handle_set_time_authorized_cb, data);
-    }
+    gint64 rtc = read_rtc_raw (local, rtc_accurate);
 
+    if (rtc < 0)
+        return FALSE;
+    rtc = rtc_drift_correct (rtc);
+    ts->tv_sec = rtc / G_USEC_PER_SEC;
+    ts->tv_nsec = (rtc % G_USEC_PER_SEC) * 1000;
     return TRUE;
 }
 
-struct invoked_set_timezone {
-    GDBusMethodInvocation *invocation;
-    gchar *timezone; /* newly allocated */
+/* Marks the step which left the clocks @offset apart as ours */
+static void
+expect_clock_step (gint64 offset)
+{
+    own_step_pending = TRUE;
+    own_step_offset = offset;
+}
+
+/* Called back in the main loop once an rtc job completed */
+typedef void (*RtcJobFunc) (gpointer user_data);
+
+typedef enum {
+    RTC_JOB_WRITE,          /* sets the rtc from the system clock */
+    RTC_JOB_READ_TO_SYSTEM, /* sets the system clock from the rtc */
+    RTC_JOB_SAMPLE,         /* reads the rtc for a drift sample */
+} RtcJobKind;
+
+/* The rtc is accessed from a worker thread, since the accurate mode
+ * waits up to a second plus rtctimeout for the second boundary. Jobs
+ * run with the clock lock held, and only their completion, in the main
+ * loop, updates the drift state, so the thread reads a stable one */
+struct rtc_job {
+    RtcJobKind kind;
+    gboolean local;
+    /* Takes a drift sample before an RTC_JOB_WRITE */
+    gboolean sample;
+    gint64 sample_system;
+    gint64 sample_rtc;
+    /* System time at which the job set a clock; 0 on failure */
+    gint64 set_at;
+    /* clock_step_realtime_offset () once the system clock was set */
+    gint64 step_offset;
+    RtcJobFunc func;
+    gpointer user_data;
 };
 
+/* Rtc jobs not completed yet */
+static guint rtc_jobs = 0;
+
 static void
-on_handle_set_timezone_authorized_cb (GObject *source_object,
-                                      GAsyncResult *res,
-                                      gpointer user_data)
+write_rtc (struct rtc_job *job)
 {
-    GError *err = NULL;
-    struct invoked_set_timezone *data;
-
-    data = (struct invoked_set_timezone *) user_data;
-    if (!check_polkit_finish (res, &err)) {
-        g_dbus_method_invocation_return_gerror (data->invocation, err);
-        goto out;
+    struct timespec ts;
+    struct tm tm;
+    int r;
+
+    if (rtc_accurate) {
+        r = hwclock_set_time_aligned (job->local, rtc_timeout);
+        if (r >= 0)
+            goto done;
+        g_debug ("Unable to set the rtc on a second boundary, setting it directly: %s", strerror (-r));
     }
 
-    G_LOCK (clock);
-    if (!set_timezone(data->timezone, &err)) {
-        g_dbus_method_invocation_return_gerror (data->invocation, err);
-        goto unlock;
+    clock_gettime (CLOCK_REALTIME, &ts);
+    if (job->local)
+        localtime_r (&ts.tv_sec, &tm);
+    else
+        gmtime_r (&ts.tv_sec, &tm);
+    if ((r = hwclock_set_time (&tm)) < 0) {
+        g_warning ("Unable to set the rtc: %s", strerror (-r));
+        return;
     }
 
-    if (local_rtc) {
-        struct timespec ts;
-        struct tm *tm;
+  done:
+    job->set_at = g_get_real_time ();
+}
 
-        /* Update kernel's view of the rtc timezone */
-        hwclock_apply_localtime_delta (NULL);
-        clock_gettime (CLOCK_REALTIME, &ts);
-        tm = localtime (&ts.tv_sec);
-        hwclock_set_time (tm);
+static void
+rtc_job_thread (GTask *task,
+                gpointer source_object,
+                gpointer task_data,
+                GCancellable *cancellable)
+{
+    struct rtc_job *job;
+    struct timespec ts;
+
+    job = (struct rtc_job *) task_data;
+    switch (job->kind) {
+    case RTC_JOB_WRITE:
+        if (job->sample) {
+            job->sample_rtc = read_rtc_raw (job->local, rtc_accurate);
+            job->sample_system = g_get_real_time ();
+        }
+        write_rtc (job);
+        break;
+    case RTC_JOB_READ_TO_SYSTEM:
+        if (read_rtc (job->local, &ts) && clock_settime (CLOCK_REALTIME, &ts) == 0) {
+            job->step_offset = clock_step_realtime_offset ();
+            job->set_at = g_get_real_time ();
+        }
+        break;
+    case RTC_JOB_SAMPLE:
+        job->sample_rtc = read_rtc_raw (job->local, rtc_accurate);
+        job->sample_system = g_get_real_time ();
+        break;
     }
+    g_task_return_boolean (task, TRUE);
+}
 
-    timedated_timedate1_complete_set_timezone (timedate1, data->invocation);
-    g_free (timezone_name);
-    timezone_name = data->timezone;
-    timedated_timedate1_set_timezone (timedate1, timezone_name);
-
-  unlock:
-    G_UNLOCK (clock);
+static void
+on_rtc_job_done_cb (GObject *source_object,
+                    GAsyncResult *res,
+                    gpointer user_data)
+{
+    struct rtc_job *job;
+
+    job = (struct rtc_job *) user_data;
+    switch (job->kind) {
+    case RTC_JOB_WRITE:
+        if (job->sample && job->sample_rtc >= 0)
+            rtc_drift_add_sample (job->sample_system, job->sample_rtc);
+        if (job->set_at != 0) {
+            rtc_cache_valid = FALSE;
+            rtc_drift_rtc_set (job->set_at, job->local);
+        }
+        break;
+    case RTC_JOB_READ_TO_SYSTEM:
+        if (job->set_at != 0) {
+            expect_clock_step (job->step_offset);
+            rtc_mirror_sync (job->local, rtc_accurate, rtc_timeout);
+        }
+        break;
+    case RTC_JOB_SAMPLE:
+        if (job->sample_rtc >= 0)
+            rtc_drift_add_periodic_sample (job->sample_system, job->sample_rtc);
+        break;
+    }
+    rtc_jobs--;
+    if (job->func != NULL)
+        job->func (job->user_data);
+    g_free (job);
+}
 
-  out:
-    g_free (data);
-    if (err != NULL)
-        g_error_free (err);
+/* Must be called with the clock lock held, and kept until @func is
+ * called */
+static void
+rtc_job_run (RtcJobKind kind,
+             gboolean local,
+             gboolean sample,
+             RtcJobFunc func,
+             gpointer user_data)
+{
+    struct rtc_job *job;
+    GTask *task;
+
+    job = g_new0 (struct rtc_job, 1);
+    job->kind = kind;
+    job->local = local;
+    job->sample = sample;
+    job->sample_rtc = -1;
+    job->func = func;
+    job->user_data = user_data;
+    rtc_jobs++;
+
+    task = g_task_new (NULL, NULL, on_rtc_job_done_cb, job);
+    g_task_set_task_data (task, job, NULL);
+    g_task_run_in_thread (task, rtc_job_thread);
+    g_object_unref (task);
 }
 
-static gboolean
-on_handle_set_timezone (TimedatedTimedate1 *timedate1,
-                        GDBusMethodInvocation *invocation,
-                        const gchar *timezone,
-                        const gboolean user_interaction,
-                        gpointer user_data)
+/* Must be called with the clock lock held, and kept until @func is
+ * called */
+static void
+sync_rtc_from_system (gboolean local,
+                      RtcJobFunc func,
+                      gpointer user_data)
 {
-    if (read_only)
-        g_dbus_method_invocation_return_dbus_error (invocation,
-                                                    DBUS_ERROR_NOT_SUPPORTED,
-                                                    SERVICE_NAME " is in read-only mode");
-    else {
-        struct invoked_set_timezone *data;
-        data = g_new0 (struct invoked_set_timezone, 1);
-        data->invocation = invocation;
-        data->timezone = g_strdup (timezone);
-        check_polkit_async (g_dbus_method_invocation_get_sender (invocation), "org.freedesktop.timedate1.set-timezone", user_interaction, on_handle_set_timezone_authorized_cb, data);
-    }
+    /* The mirrors are written from their own threads, while the job
+     * writes the primary rtc */
+    rtc_mirror_sync (local, rtc_accurate, rtc_timeout);
 
-    return TRUE;
+    /* Last chance to see how far the rtc went since it was set */
+    rtc_job_run (RTC_JOB_WRITE, local, rtc_drift_wants_sample (g_get_real_time ()), func, user_data);
 }
 
-struct invoked_set_local_rtc {
-    GDBusMethodInvocation *invocation;
-    gboolean local_rtc;
-    gboolean fix_system;
+/* An RtcJobFunc for the callers with nothing left to do */
+static void
+release_clock_lock (gpointer user_data)
+{
+    async_lock_release (clock_lock);
+}
+
+/* Work on the settings files or the ntp service which may block for
+ * seconds under load: the journal barrier flushes to storage, and the rc
+ * scripts start or stop a daemon. Run in a worker thread, with the locks
+ * of the caller held. */
+typedef gboolean (*BlockingFunc) (gpointer user_data,
+                                  GError **error);
+
+/* Called back in the main loop with the result of a BlockingFunc;
+ * @error is freed on return */
+typedef void (*BlockingDoneFunc) (gpointer user_data,
+                                  const GError *error);
+
+struct blocking_call {
+    BlockingFunc func;
+    BlockingDoneFunc done;
+    gpointer user_data;
 };
 
+/* Blocking calls not completed yet */
+static guint blocking_calls = 0;
+
 static void
-on_handle_set_local_rtc_authorized_cb (GObject *source_object,
-                                       GAsyncResult *res,
-                                       gpointer user_data)
+blocking_call_thread (GTask *task,
+                      gpointer source_object,
+                      gpointer task_data,
+                      GCancellable *cancellable)
 {
+    struct blocking_call *call;
     GError *err = NULL;
-    struct invoked_set_local_rtc *data;
-    gchar *clock = NULL;
-    const gchar *clock_types[2] = { "UTC", "local" };
 
-    data = (struct invoked_set_local_rtc *) user_data;
-    if (!check_polkit_finish (res, &err)) {
-        g_dbus_method_invocation_return_gerror (data->invocation, err);
-        goto out;
+    call = (struct blocking_call *) task_data;
+    if (call->func (call->user_data, &err))
+        g_task_return_boolean (task, TRUE);
+    else
+        g_task_return_error (task, err);
+}
+
+static void
+on_blocking_call_done_cb (GObject *source_object,
+                          GAsyncResult *res,
+                          gpointer user_data)
+{
+    struct blocking_call *call;
+    GError *err = NULL;
+
+    call = (struct blocking_call *) user_data;
+    g_task_propagate_boolean (G_TASK (res), &err);
+    blocking_calls--;
+    call->done (call->user_data, err);
+    g_clear_error (&err);
+    g_free (call);
+}
+
+static void
+run_blocking (BlockingFunc func,
+              BlockingDoneFunc done,
+              gpointer user_data)
+{
+    struct blocking_call *call;
+    GTask *task;
+
+    call = g_new0 (struct blocking_call, 1);
+    call->func = func;
+    call->done = done;
+    call->user_data = user_data;
+    blocking_calls++;
+
+    task = g_task_new (NULL, NULL, on_blocking_call_done_cb, call);
+    g_task_set_task_data (task, call, NULL);
+    g_task_run_in_thread (task, blocking_call_thread);
+    g_object_unref (task);
+}
+
+/* Must be called with the clock lock held. Returns the time the primary
+ * rtc holds, read as UTC like systemd's RTCTimeUSec, or -1 when it
+ * cannot be read. The rtc is read at most once per RTC_CACHE_USEC; in
+ * between, the last reading is extrapolated. */
+static gint64
+get_rtc_time_cached (void)
+{
+    gint64 now = g_get_monotonic_time ();
+
+    if (!rtc_cache_valid || now - rtc_cache_monotonic >= RTC_CACHE_USEC) {
+        /* Never the accurate mode here: it can block for a second */
+        rtc_cache_value = read_rtc_raw (FALSE, FALSE);
+        rtc_cache_monotonic = now;
+        rtc_cache_valid = TRUE;
     }
+    if (rtc_cache_value < 0)
+        return -1;
+    return rtc_cache_value + (now - rtc_cache_monotonic);
+}
 
-    G_LOCK (clock);
-    clock = shell_source_var (hwclock_file, "${clock}", NULL);
-    if (clock != NULL || data->local_rtc)
-        if (!shell_parser_set_and_save (hwclock_file, &err, "clock", NULL, clock_types[data->local_rtc], NULL)) {
-            g_dbus_method_invocation_return_gerror (data->invocation, err);
-            goto unlock;
-        }
+static gboolean
+ntp_synchronized (void)
+{
+    struct timex tx;
 
-    if (data->local_rtc != local_rtc) {
-        /* The clock sync code below taken almost verbatim from systemd's timedated.c, and is
-         * copyright 2011 Lennart Poettering */
-        struct timespec ts;
+    memset (&tx, 0, sizeof (tx));
+    if (adjtimex (&tx) == TIME_ERROR)
+        return FALSE;
+    return !(tx.status & STA_UNSYNC);
+}
 
-        /* Update kernel's view of the rtc timezone */
-        if (data->local_rtc)
-            hwclock_apply_localtime_delta (NULL);
-        else
-            hwclock_reset_localtime_delta ();
-
-        clock_gettime (CLOCK_REALTIME, &ts);
-        if (data->fix_system) {
-            struct tm tm;
-
-            /* Sync system clock from RTC; first,
-             * initialize the timezone fields of
-             * struct tm. */
-            if (data->local_rtc)
-                tm = *localtime(&ts.tv_sec);
-            else
-                tm = *gmtime(&ts.tv_sec);
-
-            /* Override the main fields of
-             * struct tm, but not the timezone
-             * fields */
-            if (hwclock_get_time(&tm) >= 0) {
-                /* And set the system clock
-                 * with this */
-                if (data->local_rtc)
-                    ts.tv_sec = mktime(&tm);
-                else
-                    ts.tv_sec = timegm(&tm);
-
-                clock_settime(CLOCK_REALTIME, &ts);
-            }
+static void
+on_rtc_drift_sample (gpointer user_data)
+{
+    /* Skip the sample rather than wait for the rtc */
+    if (!async_lock_try_acquire (clock_lock))
+        return;
+    rtc_job_run (RTC_JOB_SAMPLE, local_rtc, FALSE, release_clock_lock, NULL);
+}
 
-        } else {
-            struct tm *tm;
+/* Largest SetTime correction, in microseconds, which is slewed rather
+ * than stepped; 0 when slewing is disabled. See slewthreshold in
+ * timedated.conf */
+#define MAX_SLEW_THRESHOLD_MSEC 500
+static gint64 slew_threshold = 0;
 
-            /* Sync RTC from system clock */
-            if (data->local_rtc)
-                tm = localtime(&ts.tv_sec);
-            else
-                tm = gmtime(&ts.tv_sec);
+static gint64 slew_total = 0;
+static guint slew_source_id = 0;
 
-            hwclock_set_time(tm);
-        }
-    }
+/* Interval between two updates of the slew properties */
+#define SLEW_POLL_INTERVAL_SEC 1
 
-    timedated_timedate1_complete_set_timezone (timedate1, data->invocation);
-    local_rtc = data->local_rtc;
-    timedated_timedate1_set_local_rtc (timedate1, local_rtc);
+static gint64
+slew_remaining (void)
+{
+    struct timex tx;
 
-  unlock:
-    G_UNLOCK (clock);
+    memset (&tx, 0, sizeof (tx));
+    tx.modes = ADJ_OFFSET_SS_READ;
+    if (adjtimex (&tx) < 0)
+        return 0;
+    return tx.offset;
+}
 
-  out:
-    g_free (clock);
-    g_free (data);
-    if (err != NULL)
-        g_error_free (err);
+static void
+update_slew_properties (gint64 remaining)
+{
+    gdouble progress = 1;
+
+    if (slew_total != 0 && remaining != 0)
+        progress = CLAMP (1 - (gdouble) remaining / slew_total, 0, 1);
+    if (timedate1 == NULL)
+        return;
+    timedated_timedate1_set_slew_offset_usec (timedate1, remaining);
+    timedated_timedate1_set_slew_progress (timedate1, progress);
 }
 
 static gboolean
-on_handle_set_local_rtc (TimedatedTimedate1 *timedate1,
-                         GDBusMethodInvocation *invocation,
-                         const gboolean _local_rtc,
-                         const gboolean fix_system,
-                         const gboolean user_interaction,
-                         gpointer user_data)
+on_slew_poll (gpointer user_data)
 {
-    if (read_only)
-        g_dbus_method_invocation_return_dbus_error (invocation,
-                                                    DBUS_ERROR_NOT_SUPPORTED,
-                                                    SERVICE_NAME " is in read-only mode");
-    else {
-        struct invoked_set_local_rtc *data;
-        data = g_new0 (struct invoked_set_local_rtc, 1);
-        data->invocation = invocation;
-        data->local_rtc = _local_rtc;
-        data->fix_system = fix_system;
-        check_polkit_async (g_dbus_method_invocation_get_sender (invocation), "org.freedesktop.timedate1.set-local-rtc", user_interaction, on_handle_set_local_rtc_authorized_cb, data);
+    gint64 remaining;
+
+    /* Try again at the next poll */
+    if (!async_lock_try_acquire (clock_lock))
+        return G_SOURCE_CONTINUE;
+    remaining = slew_remaining ();
+    update_slew_properties (remaining);
+    if (remaining != 0) {
+        async_lock_release (clock_lock);
+        return G_SOURCE_CONTINUE;
     }
 
-    return TRUE;
+    g_debug ("Slew of %" G_GINT64_FORMAT " us complete", slew_total);
+    slew_total = 0;
+    slew_source_id = 0;
+    sync_rtc_from_system (local_rtc, release_clock_lock, NULL);
+    return G_SOURCE_REMOVE;
 }
 
-struct invoked_set_ntp {
-    GDBusMethodInvocation *invocation;
-    gboolean use_ntp;
-};
+/* Must be called with the clock lock held. Has the kernel move the
+ * clock by @usec gradually, at most 0.5 ms per second, as adjtime(3)
+ * does; the single-shot mode leaves the NTP PLL state alone. Adds to
+ * any slew in progress. */
+static int
+slew_clock (gint64 usec)
+{
+    struct timex tx;
+    gint64 remaining = slew_remaining ();
+
+    memset (&tx, 0, sizeof (tx));
+    tx.modes = ADJ_OFFSET_SINGLESHOT;
+    tx.offset = remaining + usec;
+    if (adjtimex (&tx) < 0)
+        return -errno;
+
+    /* Progress is measured against what was left to do plus the new
+     * correction */
+    slew_total = remaining + usec;
+    g_debug ("Slewing the clock by %" G_GINT64_FORMAT " us", slew_total);
+    update_slew_properties (slew_total);
+    if (slew_source_id == 0 && slew_total != 0)
+        slew_source_id = g_timeout_add_seconds (SLEW_POLL_INTERVAL_SEC, on_slew_poll, NULL);
+    return 0;
+}
 
+/* Must be called with the clock lock held */
 static void
-on_handle_set_ntp_authorized_cb (GObject *source_object,
-                                 GAsyncResult *res,
-                                 gpointer user_data)
+cancel_slew (void)
 {
-    GError *err = NULL;
-    struct invoked_set_ntp *data;
-
-    data = (struct invoked_set_ntp *) user_data;
-    if (!check_polkit_finish (res, &err)) {
-        g_dbus_method_invocation_return_gerror (data->invocation, err);
-        goto out;
-    }
+    struct timex tx;
+
+    if (slew_source_id == 0)
+        return;
+    memset (&tx, 0, sizeof (tx));
+    tx.modes = ADJ_OFFSET_SINGLESHOT;
+    adjtimex (&tx);
+    g_source_remove (slew_source_id);
+    slew_source_id = 0;
+    slew_total = 0;
+    update_slew_properties (0);
+}
 
-    G_LOCK (ntp);
-    if (ntp_service () == NULL) {
-        g_dbus_method_invocation_return_dbus_error (data->invocation, DBUS_ERROR_FAILED,
-                                                    "No ntp implementation found. Please install one of the following packages: "
-                                                    NTP_DEFAULT_SERVICES_PACKAGES);
+/* Token buckets of the callers of the methods changing something, see
+ * ratelimit* in timedated.conf; NULL when unlimited */
+#define DEFAULT_RATE_LIMIT_BURST 10
+#define DEFAULT_RATE_LIMIT_RATE 60
+#define DEFAULT_RATE_LIMIT_USER_BURST 20
+#define DEFAULT_RATE_LIMIT_USER_RATE 120
+#define MAX_RATE_LIMIT_BURST 1000
+#define MAX_RATE_LIMIT_RATE 60000
+/* Most bus names and uids tracked at once */
+#define MAX_RATE_LIMIT_KEYS 1024
+static RateLimit *sender_limit = NULL;
+static RateLimit *user_limit = NULL;
+
+/* Replies LimitsExceeded and returns FALSE when the sender of
+ * @invocation used up its calls. Checked before anything is allocated
+ * for the call */
+static gboolean
+check_sender_limit (GDBusMethodInvocation *invocation)
+{
+    const gchar *sender = g_dbus_method_invocation_get_sender (invocation);
+
+    if (sender_limit == NULL || sender == NULL || rate_limit_take (sender_limit, sender))
+        return TRUE;
+    g_dbus_method_invocation_return_dbus_error (invocation, DBUS_ERROR_LIMITS_EXCEEDED,
+                                                "Too many calls from this connection, try again later");
+    return FALSE;
+}
+
+struct check_authorization_data {
+    GDBusMethodInvocation *invocation;
+    const gchar *action_id;
+    gboolean user_interaction;
+    GAsyncReadyCallback callback;
+    gpointer user_data;
+};
+
+static void
+on_sender_uid_cb (GObject *source_object,
+                  GAsyncResult *res,
+                  gpointer user_data)
+{
+    struct check_authorization_data *data;
+    GError *err = NULL;
+    GVariant *reply;
+    guint32 uid;
+    gchar key[16];
+
+    data = (struct check_authorization_data *) user_data;
+    reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object), res, &err);
+    if (reply == NULL) {
+        g_task_report_error (NULL, data->callback, data->user_data, NULL, err);
+        goto out;
+    }
+    g_variant_get (reply, "(u)", &uid);
+    g_variant_unref (reply);
+
+    g_snprintf (key, sizeof (key), "%u", uid);
+    if (!rate_limit_take (user_limit, key)) {
+        g_task_report_new_error (NULL, data->callback, data->user_data, NULL,
+                                 G_DBUS_ERROR, G_DBUS_ERROR_LIMITS_EXCEEDED,
+                                 "Too many calls from uid %u, try again later", uid);
+        goto out;
+    }
+    check_polkit_async (g_dbus_method_invocation_get_sender (data->invocation), data->action_id,
+                        data->user_interaction, data->callback, data->user_data);
+
+  out:
+    g_free (data);
+}
+
+/* Like check_polkit_async, but a call over the limit of the uid of its
+ * sender fails with LimitsExceeded before polkit is asked. The uid is the
+ * one the bus knows the sender by */
+static void
+check_authorization_async (GDBusMethodInvocation *invocation,
+                           const gchar *action_id,
+                           gboolean user_interaction,
+                           GAsyncReadyCallback callback,
+                           gpointer user_data)
+{
+    struct check_authorization_data *data;
+    const gchar *sender = g_dbus_method_invocation_get_sender (invocation);
+
+    if (user_limit == NULL || sender == NULL) {
+        check_polkit_async (sender, action_id, user_interaction, callback, user_data);
+        return;
+    }
+
+    data = g_new0 (struct check_authorization_data, 1);
+    data->invocation = invocation;
+    data->action_id = action_id;
+    data->user_interaction = user_interaction;
+    data->callback = callback;
+    data->user_data = user_data;
+    g_dbus_connection_call (g_dbus_method_invocation_get_connection (invocation),
+                            "org.freedesktop.DBus",
+                            "/org/freedesktop/DBus",
+                            "org.freedesktop.DBus",
+                            "GetConnectionUnixUser",
+                            g_variant_new ("(s)", sender),
+                            G_VARIANT_TYPE ("(u)"),
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            NULL,
+                            on_sender_uid_cb,
+                            data);
+}
+
+static void
+record_queue_wait (QueueWait method,
+                   gint64 wait)
+{
+    queue_waits[method].calls++;
+    queue_waits[method].max = MAX (queue_waits[method].max, wait);
+    queue_waits[method].total += wait;
+    g_debug ("%s: waited %" G_GINT64_FORMAT " us for the locks"
+             " (%" G_GUINT64_FORMAT " calls, mean %" G_GINT64_FORMAT " us, max %" G_GINT64_FORMAT " us)",
+             queue_wait_methods[method], wait, queue_waits[method].calls,
+             queue_waits[method].total / (gint64) queue_waits[method].calls,
+             queue_waits[method].max);
+}
+
+struct invoked_set_time {
+    GDBusMethodInvocation *invocation;
+    gint64 usec_utc;
+    gboolean relative;
+    /* CLOCK_MONOTONIC when the call arrived */
+    gint64 received;
+    /* CLOCK_MONOTONIC when the call was given to set_time_work */
+    gint64 handed_over;
+    /* 0 or a negative errno, set by set_time_work */
+    int result;
+    /* clock_step_realtime_offset () once set_time_work stepped the clock */
+    gint64 step_offset;
+};
+
+/* Time spent in polkit and waiting for the clock lock, added to the
+ * absolute SetTime calls */
+static struct {
+    guint64 calls;
+    gint64 last;
+    gint64 max;
+    gint64 total;
+} set_time_compensation;
+
+static gint64
+compensate_set_time (struct invoked_set_time *data)
+{
+    gint64 elapsed = g_get_monotonic_time () - data->received;
+
+    set_time_compensation.calls++;
+    set_time_compensation.last = elapsed;
+    set_time_compensation.max = MAX (set_time_compensation.max, elapsed);
+    set_time_compensation.total += elapsed;
+    g_debug ("SetTime: compensated %" G_GINT64_FORMAT " us of latency"
+             " (%" G_GUINT64_FORMAT " calls, mean %" G_GINT64_FORMAT " us, max %" G_GINT64_FORMAT " us)",
+             elapsed, set_time_compensation.calls,
+             set_time_compensation.total / (gint64) set_time_compensation.calls,
+             set_time_compensation.max);
+    return elapsed;
+}
+
+/* Runs in the clock thread, when there is one; see clockthread in
+ * timedated.conf */
+static void
+set_time_work (gpointer user_data)
+{
+    struct invoked_set_time *data;
+    struct timespec ts = { 0, 0 };
+
+    data = (struct invoked_set_time *) user_data;
+    if (data->relative) {
+        int r = clock_step (data->usec_utc);
+
+        if (r == 0)
+            goto set;
+        if (r != -EINVAL && r != -EOPNOTSUPP && r != -ENOSYS) {
+            data->result = r;
+            return;
+        }
+        g_debug ("Unable to step the clock in the kernel, setting it instead: %s", strerror (-r));
+        if (clock_gettime (CLOCK_REALTIME, &ts)) {
+            data->result = -errno;
+            return;
+        }
+    } else
+        /* The time spent waiting for this thread */
+        data->usec_utc += g_get_monotonic_time () - data->handed_over;
+    ts.tv_sec += data->usec_utc / 1000000;
+    ts.tv_nsec += (data->usec_utc % 1000000) * 1000;
+    if (ts.tv_nsec < 0) {
+        ts.tv_sec--;
+        ts.tv_nsec += 1000000000;
+    } else if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    if (clock_settime (CLOCK_REALTIME, &ts)) {
+        data->result = -errno;
+        return;
+    }
+
+  set:
+    data->step_offset = clock_step_realtime_offset ();
+    data->result = 0;
+}
+
+static void
+set_time_finish (gpointer user_data)
+{
+    struct invoked_set_time *data;
+
+    data = (struct invoked_set_time *) user_data;
+    if (data->result < 0)
+        g_dbus_method_invocation_return_dbus_error (data->invocation, DBUS_ERROR_FAILED, strerror (-data->result));
+    else
+        timedated_timedate1_complete_set_time (timedate1, data->invocation);
+    async_lock_release (clock_lock);
+    g_free (data);
+}
+
+static void
+set_time_done (gpointer user_data)
+{
+    struct invoked_set_time *data;
+
+    data = (struct invoked_set_time *) user_data;
+    if (data->result < 0) {
+        set_time_finish (data);
+        return;
+    }
+
+    expect_clock_step (data->step_offset);
+    sync_rtc_from_system (local_rtc, set_time_finish, data);
+}
+
+static void
+set_time_locked (gint64 wait,
+                 gpointer user_data)
+{
+    struct invoked_set_time *data;
+
+    data = (struct invoked_set_time *) user_data;
+    record_queue_wait (WAIT_SET_TIME, wait);
+    if (!data->relative && data->usec_utc < 0) {
+        g_dbus_method_invocation_return_dbus_error (data->invocation, DBUS_ERROR_INVALID_ARGS, "Attempt to set time before epoch");
         goto unlock;
     }
-    if ((data->use_ntp && !service_enable (ntp_service (), &err)) ||
-        (!data->use_ntp && !service_disable (ntp_service (), &err)))
-    {
+
+    /* The caller meant the time at which it called us */
+    if (!data->relative)
+        data->usec_utc += compensate_set_time (data);
+
+    if (slew_threshold > 0) {
+        gint64 delta = data->relative ? data->usec_utc : data->usec_utc - g_get_real_time ();
+
+        if (ABS (delta) <= slew_threshold) {
+            int r = slew_clock (delta);
+
+            if (r == 0) {
+                timedated_timedate1_complete_set_time (timedate1, data->invocation);
+                goto unlock;
+            }
+            g_debug ("Unable to slew the clock, stepping it instead: %s", strerror (-r));
+        }
+    }
+
+    /* A slew in progress would move the clock off the new time */
+    if (!data->relative)
+        cancel_slew ();
+
+    data->handed_over = g_get_monotonic_time ();
+    if (!clock_thread_run (set_time_work, set_time_done, data)) {
+        set_time_work (data);
+        set_time_done (data);
+    }
+    return;
+
+  unlock:
+    async_lock_release (clock_lock);
+    g_free (data);
+}
+
+static void
+on_handle_set_time_authorized_cb (GObject *source_object,
+                                  GAsyncResult *res,
+                                  gpointer user_data)
+{
+    GError *err = NULL;
+    struct invoked_set_time *data;
+
+    data = (struct invoked_set_time *) user_data;
+    if (!check_polkit_finish (res, &err)) {
+        g_dbus_method_invocation_return_gerror (data->invocation, err);
+        g_error_free (err);
+        g_free (data);
+        return;
+    }
+
+    async_lock_acquire_async (clock_lock, CLOCK_PRIORITY, set_time_locked, data);
+}
+
+static gboolean
+on_handle_set_time (TimedatedTimedate1 *timedate1,
+                    GDBusMethodInvocation *invocation,
+                    const gint64 usec_utc,
+                    const gboolean relative,
+                    const gboolean user_interaction,
+                    gpointer user_data)
+{
+    if (read_only)
+        g_dbus_method_invocation_return_dbus_error (invocation,
+                                                    DBUS_ERROR_NOT_SUPPORTED,
+                                                    SERVICE_NAME " is in read-only mode");
+    else if (check_sender_limit (invocation)) {
+        struct invoked_set_time *data;
+        data = g_new0 (struct invoked_set_time, 1);
+        data->invocation = invocation;
+        data->usec_utc = usec_utc;
+        data->relative = relative;
+        data->received = g_get_monotonic_time ();
+        check_authorization_async (invocation, "org.freedesktop.timedate1.set-time", user_interaction, on_handle_set_time_authorized_cb, data);
+    }
+
+    return TRUE;
+}
+
+/* Authorized calls changing the same setting queue for the same locks.
+ * When a newer one is authorized before an older one got its locks, the
+ * older one is superseded: it is not applied, and its caller gets the
+ * result of the newer one. */
+struct queued_call {
+    gboolean superseded;
+    GPtrArray *followers; /* invocations of the calls superseded by this one */
+};
+
+static void
+queued_call_supersede (struct queued_call *older,
+                       GDBusMethodInvocation **older_invocation,
+                       struct queued_call *newer)
+{
+    newer->followers = older->followers != NULL ? older->followers : g_ptr_array_new ();
+    older->followers = NULL;
+    g_ptr_array_add (newer->followers, *older_invocation);
+    *older_invocation = NULL;
+    older->superseded = TRUE;
+}
+
+/* Give the result of @call to the callers it superseded */
+static void
+queued_call_complete (struct queued_call *call,
+                      const GError *error)
+{
+    guint i;
+
+    if (call->followers == NULL)
+        return;
+    g_debug ("Completing %u superseded calls", call->followers->len);
+    for (i = 0; i < call->followers->len; i++) {
+        GDBusMethodInvocation *invocation = g_ptr_array_index (call->followers, i);
+
+        if (error != NULL)
+            g_dbus_method_invocation_return_gerror (invocation, error);
+        else
+            g_dbus_method_invocation_return_value (invocation, NULL);
+    }
+    g_clear_pointer (&call->followers, g_ptr_array_unref);
+}
+
+struct invoked_set_timezone {
+    GDBusMethodInvocation *invocation;
+    struct queued_call queue;
+    gchar *timezone; /* newly allocated */
+    gint pending; /* of the authorization and the preparation */
+    gint64 received;
+    gint64 authorized_at;
+    gint64 prepared_at;
+    gboolean authorized;
+    GError *authorization_error;
+    SettingsTransaction *transaction; /* staged, or NULL on error */
+    GError *prepare_error;
+};
+
+/* The last authorized SetTimezone not running yet */
+static struct invoked_set_timezone *newest_set_timezone = NULL;
+
+static void
+invoked_set_timezone_free (struct invoked_set_timezone *data)
+{
+    settings_transaction_free (data->transaction);
+    g_clear_error (&data->authorization_error);
+    g_clear_error (&data->prepare_error);
+    g_free (data->timezone);
+    g_free (data);
+}
+
+static void
+set_timezone_unlock (struct invoked_set_timezone *data,
+                     const GError *result)
+{
+    async_lock_release (clock_lock);
+    async_lock_release (zone_lock);
+    queued_call_complete (&data->queue, result);
+    invoked_set_timezone_free (data);
+}
+
+/* Once the new zone is committed, and the rtc follows it */
+static void
+set_timezone_done (gpointer user_data)
+{
+    struct invoked_set_timezone *data;
+
+    data = (struct invoked_set_timezone *) user_data;
+    timedated_timedate1_complete_set_timezone (timedate1, data->invocation);
+    g_free (timezone_name);
+    timezone_name = g_steal_pointer (&data->timezone);
+    timedated_timedate1_set_timezone (timedate1, timezone_name);
+    dst_watch_set_timezone (timezone_name);
+    set_timezone_unlock (data, NULL);
+}
+
+static gboolean
+set_timezone_commit (gpointer user_data,
+                     GError **error)
+{
+    struct invoked_set_timezone *data;
+
+    data = (struct invoked_set_timezone *) user_data;
+    return settings_transaction_commit (data->transaction, error);
+}
+
+static void
+set_timezone_committed (gpointer user_data,
+                        const GError *error)
+{
+    struct invoked_set_timezone *data;
+
+    data = (struct invoked_set_timezone *) user_data;
+    if (error != NULL) {
+        g_dbus_method_invocation_return_gerror (data->invocation, error);
+        set_timezone_unlock (data, error);
+        return;
+    }
+
+    if (local_rtc) {
+        /* Update kernel's view of the rtc timezone */
+        hwclock_apply_localtime_delta (NULL);
+        sync_rtc_from_system (TRUE, set_timezone_done, data);
+    } else
+        set_timezone_done (data);
+}
+
+static void
+set_timezone_locked (gint64 wait,
+                     gpointer user_data)
+{
+    const GError *result = NULL;
+    struct invoked_set_timezone *data;
+
+    data = (struct invoked_set_timezone *) user_data;
+    record_queue_wait (WAIT_SET_TIMEZONE, wait);
+    if (newest_set_timezone == data)
+        newest_set_timezone = NULL;
+    if (data->queue.superseded) {
+        /* The staged files are discarded */
+        g_debug ("SetTimezone %s superseded by a newer call", data->timezone);
+        goto unlock;
+    }
+
+    if (!g_strcmp0 (data->timezone, timezone_name)) {
+        timedated_timedate1_complete_set_timezone (timedate1, data->invocation);
+        goto unlock;
+    }
+
+    if (data->transaction == NULL) {
+        result = data->prepare_error;
+        g_dbus_method_invocation_return_gerror (data->invocation, result);
+        goto unlock;
+    }
+    run_blocking (set_timezone_commit, set_timezone_committed, data);
+    return;
+
+  unlock:
+    set_timezone_unlock (data, result);
+}
+
+/* Called when both the authorization and the preparation are done */
+static void
+set_timezone_finish (struct invoked_set_timezone *data)
+{
+    AsyncLock *locks[] = { zone_lock, clock_lock };
+
+    g_debug ("SetTimezone prepared in %" G_GINT64_FORMAT " us, authorized in %" G_GINT64_FORMAT " us",
+             data->prepared_at - data->received, data->authorized_at - data->received);
+
+    /* On denial, the staged files are discarded */
+    if (!data->authorized) {
+        g_dbus_method_invocation_return_gerror (data->invocation, data->authorization_error);
+        invoked_set_timezone_free (data);
+        return;
+    }
+
+    if (newest_set_timezone != NULL)
+        queued_call_supersede (&newest_set_timezone->queue, &newest_set_timezone->invocation, &data->queue);
+    newest_set_timezone = data;
+    async_lock_acquire_all_async (locks, G_N_ELEMENTS (locks), CONFIG_PRIORITY, set_timezone_locked, data);
+}
+
+static void
+on_handle_set_timezone_authorized_cb (GObject *source_object,
+                                      GAsyncResult *res,
+                                      gpointer user_data)
+{
+    struct invoked_set_timezone *data;
+
+    data = (struct invoked_set_timezone *) user_data;
+    data->authorized = check_polkit_finish (res, &data->authorization_error);
+    data->authorized_at = g_get_monotonic_time ();
+    if (--data->pending == 0)
+        set_timezone_finish (data);
+}
+
+/* Everything SetTimezone does short of replacing the files, run in a
+ * worker thread while polkit is asked */
+static void
+set_timezone_prepare_thread (GTask *task,
+                             gpointer source_object,
+                             gpointer task_data,
+                             GCancellable *cancellable)
+{
+    struct invoked_set_timezone *data;
+    SettingsTransaction *transaction;
+    GError *err = NULL;
+
+    data = (struct invoked_set_timezone *) task_data;
+    transaction = settings_transaction_new ();
+    if (!set_timezone (data->timezone, transaction, &err)) {
+        settings_transaction_free (transaction);
+        g_task_return_error (task, err);
+        return;
+    }
+    g_task_return_pointer (task, transaction, (GDestroyNotify) settings_transaction_free);
+}
+
+static void
+on_set_timezone_prepared_cb (GObject *source_object,
+                             GAsyncResult *res,
+                             gpointer user_data)
+{
+    struct invoked_set_timezone *data;
+
+    data = (struct invoked_set_timezone *) user_data;
+    data->transaction = g_task_propagate_pointer (G_TASK (res), &data->prepare_error);
+    data->prepared_at = g_get_monotonic_time ();
+    if (--data->pending == 0)
+        set_timezone_finish (data);
+}
+
+static gboolean
+on_handle_set_timezone (TimedatedTimedate1 *timedate1,
+                        GDBusMethodInvocation *invocation,
+                        const gchar *timezone,
+                        const gboolean user_interaction,
+                        gpointer user_data)
+{
+    TzCatalog *catalog;
+
+    if (read_only)
+        g_dbus_method_invocation_return_dbus_error (invocation,
+                                                    DBUS_ERROR_NOT_SUPPORTED,
+                                                    SERVICE_NAME " is in read-only mode");
+    else if ((catalog = get_tz_catalog ()) != NULL && !tz_catalog_lookup (catalog, timezone, NULL))
+        g_dbus_method_invocation_return_error (invocation,
+                                               G_DBUS_ERROR,
+                                               G_DBUS_ERROR_INVALID_ARGS,
+                                               "Invalid or not installed time zone '%s'", timezone);
+    else if (!g_strcmp0 (canonical_timezone (timezone), timezone_name))
+        /* The current zone, or an alias for it: nothing to write, nor to
+         * authorize */
+        timedated_timedate1_complete_set_timezone (timedate1, invocation);
+    else if (check_sender_limit (invocation)) {
+        struct invoked_set_timezone *data;
+        GTask *task;
+
+        data = g_new0 (struct invoked_set_timezone, 1);
+        data->invocation = invocation;
+        data->timezone = g_strdup (canonical_timezone (timezone));
+        data->received = g_get_monotonic_time ();
+        data->pending = 2;
+        check_authorization_async (invocation, "org.freedesktop.timedate1.set-timezone", user_interaction, on_handle_set_timezone_authorized_cb, data);
+
+        /* Stage the new files in the meantime: only the commit waits for
+         * the authorization */
+        task = g_task_new (NULL, NULL, on_set_timezone_prepared_cb, data);
+        g_task_set_task_data (task, data, NULL);
+        g_task_run_in_thread (task, set_timezone_prepare_thread);
+        g_object_unref (task);
+    }
+
+    return TRUE;
+}
+
+static gboolean
+on_handle_list_timezones (TimedatedTimedate1 *timedate1,
+                          GDBusMethodInvocation *invocation,
+                          gpointer user_data)
+{
+    TzCatalog *catalog;
+
+    if ((catalog = get_tz_catalog ()) == NULL)
+        g_dbus_method_invocation_return_dbus_error (invocation,
+                                                    DBUS_ERROR_FAILED,
+                                                    "Unable to read the list of time zones from " ZONEINFODIR);
+    else
+        timedated_timedate1_complete_list_timezones (timedate1, invocation, tz_catalog_get_zones (catalog));
+
+    return TRUE;
+}
+
+static gboolean
+on_handle_search_timezones (TimedatedTimedate1 *timedate1,
+                            GDBusMethodInvocation *invocation,
+                            const gchar *query,
+                            const guint limit,
+                            gpointer user_data)
+{
+    TzCatalog *catalog;
+    guint results[TZ_CATALOG_MAX_RESULTS];
+    const gchar *zones[TZ_CATALOG_MAX_RESULTS + 1];
+    guint i, n_results;
+
+    if ((catalog = get_tz_catalog ()) == NULL) {
+        g_dbus_method_invocation_return_dbus_error (invocation,
+                                                    DBUS_ERROR_FAILED,
+                                                    "Unable to read the list of time zones from " ZONEINFODIR);
+        return TRUE;
+    }
+
+    n_results = tz_catalog_search (catalog, query, results,
+                                   limit == 0 ? TZ_CATALOG_MAX_RESULTS : MIN (limit, TZ_CATALOG_MAX_RESULTS));
+    for (i = 0; i < n_results; i++)
+        zones[i] = tz_catalog_get_zones (catalog)[results[i]];
+    zones[n_results] = NULL;
+    timedated_timedate1_complete_search_timezones (timedate1, invocation, zones);
+
+    return TRUE;
+}
+
+static gboolean
+on_handle_get_timezone_offsets (TimedatedTimedate1 *timedate1,
+                                GDBusMethodInvocation *invocation,
+                                const gchar *timezone,
+                                GVariant *usec_utc,
+                                gpointer user_data)
+{
+    GError *err = NULL;
+    TzCatalog *catalog;
+    TzFile *tzfile;
+    GVariantBuilder builder;
+    const gint64 *usecs;
+    gint64 *times;
+    TzOffset *offsets;
+    gsize i, n_times = 0;
+
+    if ((catalog = get_tz_catalog ()) != NULL && !tz_catalog_lookup (catalog, timezone, NULL)) {
+        g_dbus_method_invocation_return_error (invocation,
+                                               G_DBUS_ERROR,
+                                               G_DBUS_ERROR_INVALID_ARGS,
+                                               "Invalid or not installed time zone '%s'", timezone);
+        return TRUE;
+    }
+    usecs = g_variant_get_fixed_array (usec_utc, &n_times, sizeof (gint64));
+    if (n_times > MAX_OFFSET_QUERIES) {
+        g_dbus_method_invocation_return_dbus_error (invocation,
+                                                    DBUS_ERROR_INVALID_ARGS,
+                                                    "Too many instants in one query");
+        return TRUE;
+    }
+    if ((tzfile = tz_file_cache_get (timezone, &err)) == NULL) {
+        g_dbus_method_invocation_return_gerror (invocation, err);
+        g_error_free (err);
+        return TRUE;
+    }
+
+    times = g_new (gint64, n_times);
+    offsets = g_new (TzOffset, n_times);
+    for (i = 0; i < n_times; i++)
+        /* Round towards the past, also before the epoch */
+        times[i] = usecs[i] / G_USEC_PER_SEC - (usecs[i] % G_USEC_PER_SEC < 0);
+    tz_file_lookup_many (tzfile, times, n_times, offsets);
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ibs)"));
+    for (i = 0; i < n_times; i++)
+        g_variant_builder_add (&builder, "(ibs)", offsets[i].utc_offset, offsets[i].is_dst, offsets[i].abbreviation);
+    timedated_timedate1_complete_get_timezone_offsets (timedate1, invocation, g_variant_builder_end (&builder));
+
+    g_free (times);
+    g_free (offsets);
+    return TRUE;
+}
+
+/* GetTimeInfo samples the clocks this many times, and keeps the sample
+ * which took the least time, should it have been preempted */
+#define TIME_INFO_ATTEMPTS 4
+
+static gint64
+timespec_to_usec (const struct timespec *ts)
+{
+    return (gint64) ts->tv_sec * G_USEC_PER_SEC + ts->tv_nsec / 1000;
+}
+
+static void
+get_time_info_locked (gint64 wait,
+                      gpointer user_data)
+{
+    GDBusMethodInvocation *invocation = (GDBusMethodInvocation *) user_data;
+    struct timespec before, after, real, boot;
+    gint64 realtime = 0, monotonic = 0, boottime = 0, error = G_MAXINT64;
+    gint64 rtc;
+    TzFile *tzfile = NULL;
+    TzOffset offset = { 0, FALSE, "" };
+    guint i;
+
+    record_queue_wait (WAIT_GET_TIME_INFO, wait);
+
+    /* Both CLOCK_MONOTONIC readings bracket the others; the sample is
+     * taken at their midpoint, within half the bracket */
+    for (i = 0; i < TIME_INFO_ATTEMPTS; i++) {
+        gint64 bracket;
+
+        clock_gettime (CLOCK_MONOTONIC, &before);
+        clock_gettime (CLOCK_REALTIME, &real);
+        clock_gettime (CLOCK_BOOTTIME, &boot);
+        clock_gettime (CLOCK_MONOTONIC, &after);
+
+        bracket = timespec_to_usec (&after) - timespec_to_usec (&before);
+        if (bracket < error) {
+            error = bracket;
+            monotonic = timespec_to_usec (&before) + bracket / 2;
+            realtime = timespec_to_usec (&real);
+            boottime = timespec_to_usec (&boot);
+        }
+    }
+    error = (error + 1) / 2;
+
+    /* Brought to the same instant as the other clocks */
+    if ((rtc = get_rtc_time_cached ()) >= 0)
+        rtc -= g_get_monotonic_time () - monotonic;
+
+    if (timezone_name != NULL)
+        tzfile = tz_file_cache_get (timezone_name, NULL);
+    if (tzfile != NULL)
+        tz_file_lookup (tzfile, realtime / G_USEC_PER_SEC, &offset);
+
+    timedated_timedate1_complete_get_time_info (timedate1, invocation,
+                                                realtime, monotonic, boottime, error,
+                                                rtc >= 0 ? rtc : 0, local_rtc,
+                                                timezone_name != NULL ? timezone_name : "",
+                                                offset.utc_offset, offset.is_dst,
+                                                use_ntp, ntp_synchronized ());
+    async_lock_release (clock_lock);
+}
+
+static gboolean
+on_handle_get_time_info (TimedatedTimedate1 *timedate1,
+                         GDBusMethodInvocation *invocation,
+                         gpointer user_data)
+{
+    async_lock_acquire_async (clock_lock, CLOCK_PRIORITY, get_time_info_locked, invocation);
+    return TRUE;
+}
+
+/* Stage the hwclock file in @transaction */
+static gboolean
+set_local_rtc_file (gboolean local,
+                    SettingsTransaction *transaction,
+                    GError **error)
+{
+    const gchar *clock_types[2] = { "UTC", "local" };
+    gchar *clock, *contents = NULL;
+    ShellParser *parser = NULL;
+    gboolean ret = FALSE;
+
+    /* Leave the file alone if it does not set the clock and the default
+     * is wanted */
+    clock = shell_source_var (hwclock_file, "${clock}", NULL);
+    if (clock == NULL && !local) {
+        ret = TRUE;
+        goto out;
+    }
+
+    if ((parser = shell_parser_new (hwclock_file, error)) == NULL)
+        goto out;
+    if (!shell_parser_set_variable (parser, "clock", clock_types[local], TRUE)) {
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                     "Unable to set clock in '%s'", parser->filename);
+        goto out;
+    }
+    contents = shell_parser_to_string (parser);
+    if (!settings_transaction_replace (transaction, hwclock_file, contents, strlen (contents), 0644, error)) {
+        g_prefix_error (error, "Unable to save '%s': ", parser->filename);
+        goto out;
+    }
+    ret = TRUE;
+
+  out:
+    shell_parser_free (parser);
+    g_free (contents);
+    g_free (clock);
+    return ret;
+}
+
+/* Must be called with the clock lock held, and kept until @func is
+ * called. Switches the kernel and the rtc to @local, touching the rtc
+ * once. */
+static void
+apply_local_rtc (gboolean local,
+                 gboolean fix_system,
+                 RtcJobFunc func,
+                 gpointer user_data)
+{
+    /* The clock sync code below taken almost verbatim from systemd's timedated.c, and is
+     * copyright 2011 Lennart Poettering */
+
+    /* Update kernel's view of the rtc timezone */
+    if (local)
+        hwclock_apply_localtime_delta (NULL);
+    else
+        hwclock_reset_localtime_delta ();
+
+    if (fix_system)
+        /* Sync system clock from RTC */
+        rtc_job_run (RTC_JOB_READ_TO_SYSTEM, local, FALSE, func, user_data);
+    else
+        /* Sync RTC from system clock */
+        sync_rtc_from_system (local, func, user_data);
+}
+
+struct invoked_set_local_rtc {
+    GDBusMethodInvocation *invocation;
+    gboolean local_rtc;
+    gboolean fix_system;
+};
+
+static void
+set_local_rtc_done (gpointer user_data)
+{
+    struct invoked_set_local_rtc *data;
+
+    data = (struct invoked_set_local_rtc *) user_data;
+    timedated_timedate1_complete_set_local_rtc (timedate1, data->invocation);
+    local_rtc = data->local_rtc;
+    timedated_timedate1_set_local_rtc (timedate1, local_rtc);
+    async_lock_release (clock_lock);
+    async_lock_release (zone_lock);
+    g_free (data);
+}
+
+static gboolean
+set_local_rtc_commit (gpointer user_data,
+                      GError **error)
+{
+    struct invoked_set_local_rtc *data;
+    SettingsTransaction *transaction;
+    gboolean ret;
+
+    data = (struct invoked_set_local_rtc *) user_data;
+    transaction = settings_transaction_new ();
+    ret = set_local_rtc_file (data->local_rtc, transaction, error) &&
+        settings_transaction_commit (transaction, error);
+    settings_transaction_free (transaction);
+    return ret;
+}
+
+static void
+set_local_rtc_committed (gpointer user_data,
+                         const GError *error)
+{
+    struct invoked_set_local_rtc *data;
+
+    data = (struct invoked_set_local_rtc *) user_data;
+    if (error != NULL) {
+        g_dbus_method_invocation_return_gerror (data->invocation, error);
+        async_lock_release (clock_lock);
+        async_lock_release (zone_lock);
+        g_free (data);
+        return;
+    }
+
+    if (data->local_rtc != local_rtc)
+        apply_local_rtc (data->local_rtc, data->fix_system, set_local_rtc_done, data);
+    else
+        set_local_rtc_done (data);
+}
+
+static void
+set_local_rtc_locked (gint64 wait,
+                      gpointer user_data)
+{
+    record_queue_wait (WAIT_SET_LOCAL_RTC, wait);
+    run_blocking (set_local_rtc_commit, set_local_rtc_committed, user_data);
+}
+
+static void
+on_handle_set_local_rtc_authorized_cb (GObject *source_object,
+                                       GAsyncResult *res,
+                                       gpointer user_data)
+{
+    GError *err = NULL;
+    struct invoked_set_local_rtc *data;
+    AsyncLock *locks[] = { zone_lock, clock_lock };
+
+    data = (struct invoked_set_local_rtc *) user_data;
+    if (!check_polkit_finish (res, &err)) {
         g_dbus_method_invocation_return_gerror (data->invocation, err);
-        goto unlock;
+        g_error_free (err);
+        g_free (data);
+        return;
     }
 
-    timedated_timedate1_complete_set_ntp (timedate1, data->invocation);
-    use_ntp = data->use_ntp;
-    timedated_timedate1_set_ntp (timedate1, use_ntp);
+    async_lock_acquire_all_async (locks, G_N_ELEMENTS (locks), CONFIG_PRIORITY, set_local_rtc_locked, data);
+}
 
-  unlock:
-    G_UNLOCK (ntp);
+static gboolean
+on_handle_set_local_rtc (TimedatedTimedate1 *timedate1,
+                         GDBusMethodInvocation *invocation,
+                         const gboolean _local_rtc,
+                         const gboolean fix_system,
+                         const gboolean user_interaction,
+                         gpointer user_data)
+{
+    if (read_only)
+        g_dbus_method_invocation_return_dbus_error (invocation,
+                                                    DBUS_ERROR_NOT_SUPPORTED,
+                                                    SERVICE_NAME " is in read-only mode");
+    else if (check_sender_limit (invocation)) {
+        struct invoked_set_local_rtc *data;
+        data = g_new0 (struct invoked_set_local_rtc, 1);
+        data->invocation = invocation;
+        data->local_rtc = _local_rtc;
+        data->fix_system = fix_system;
+        check_authorization_async (invocation, "org.freedesktop.timedate1.set-local-rtc", user_interaction, on_handle_set_local_rtc_authorized_cb, data);
+    }
 
-  out:
+    return TRUE;
+}
+
+struct invoked_set_ntp {
+    GDBusMethodInvocation *invocation;
+    struct queued_call queue;
+    gboolean use_ntp;
+    const gchar *service;
+};
+
+/* The last authorized SetNTP not running yet */
+static struct invoked_set_ntp *newest_set_ntp = NULL;
+
+static void
+set_ntp_unlock (struct invoked_set_ntp *data,
+                const GError *result)
+{
+    async_lock_release (ntp_lock);
+    queued_call_complete (&data->queue, result);
     g_free (data);
-    if (err != NULL)
+}
+
+static gboolean
+set_ntp_switch (gpointer user_data,
+                GError **error)
+{
+    struct invoked_set_ntp *data;
+
+    data = (struct invoked_set_ntp *) user_data;
+    return switch_ntp_service (data->service, data->use_ntp, error);
+}
+
+static void
+set_ntp_switched (gpointer user_data,
+                  const GError *error)
+{
+    struct invoked_set_ntp *data;
+
+    data = (struct invoked_set_ntp *) user_data;
+    if (error != NULL)
+        g_dbus_method_invocation_return_gerror (data->invocation, error);
+    else {
+        timedated_timedate1_complete_set_ntp (timedate1, data->invocation);
+        use_ntp = data->use_ntp;
+        timedated_timedate1_set_ntp (timedate1, use_ntp);
+    }
+    set_ntp_unlock (data, error);
+}
+
+static void
+set_ntp_locked (gint64 wait,
+                gpointer user_data)
+{
+    GError *err = NULL;
+    struct invoked_set_ntp *data;
+
+    data = (struct invoked_set_ntp *) user_data;
+    record_queue_wait (WAIT_SET_NTP, wait);
+    if (newest_set_ntp == data)
+        newest_set_ntp = NULL;
+    if (data->queue.superseded) {
+        g_debug ("SetNTP %s superseded by a newer call", data->use_ntp ? "true" : "false");
+        set_ntp_unlock (data, NULL);
+        return;
+    }
+
+    if ((data->service = ntp_service ()) == NULL) {
+        g_set_error (&err, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
+                     "No ntp implementation found. Please install one of the following packages: "
+                     NTP_DEFAULT_SERVICES_PACKAGES);
+        g_dbus_method_invocation_return_gerror (data->invocation, err);
+        set_ntp_unlock (data, err);
+        g_error_free (err);
+        return;
+    }
+    /* The rc script may take seconds to start or stop the daemon */
+    run_blocking (set_ntp_switch, set_ntp_switched, data);
+}
+
+static void
+on_handle_set_ntp_authorized_cb (GObject *source_object,
+                                 GAsyncResult *res,
+                                 gpointer user_data)
+{
+    GError *err = NULL;
+    struct invoked_set_ntp *data;
+
+    data = (struct invoked_set_ntp *) user_data;
+    if (!check_polkit_finish (res, &err)) {
+        g_dbus_method_invocation_return_gerror (data->invocation, err);
         g_error_free (err);
+        g_free (data);
+        return;
+    }
+
+    if (newest_set_ntp != NULL)
+        queued_call_supersede (&newest_set_ntp->queue, &newest_set_ntp->invocation, &data->queue);
+    newest_set_ntp = data;
+    async_lock_acquire_async (ntp_lock, CONFIG_PRIORITY, set_ntp_locked, data);
 }
 
 static gboolean
@@ -659,17 +1998,336 @@ on_handle_set_ntp (TimedatedTimedate1 *timedate1,
         g_dbus_method_invocation_return_dbus_error (invocation,
                                                     DBUS_ERROR_NOT_SUPPORTED,
                                                     SERVICE_NAME " is in read-only mode");
-    else {
+    else if (check_sender_limit (invocation)) {
         struct invoked_set_ntp *data;
         data = g_new0 (struct invoked_set_ntp, 1);
         data->invocation = invocation;
         data->use_ntp = _use_ntp;
-        check_polkit_async (g_dbus_method_invocation_get_sender (invocation), "org.freedesktop.timedate1.set-ntp", user_interaction, on_handle_set_ntp_authorized_cb, data);
+        check_authorization_async (invocation, "org.freedesktop.timedate1.set-ntp", user_interaction, on_handle_set_ntp_authorized_cb, data);
+    }
+
+    return TRUE;
+}
+
+struct invoked_apply_settings {
+    GDBusMethodInvocation *invocation;
+    gchar *timezone; /* newly allocated, canonical; NULL if not requested */
+    gboolean has_local_rtc;
+    gboolean local_rtc;
+    gboolean fix_system;
+    gboolean has_ntp;
+    gboolean use_ntp;
+    /* Against the state once the locks are held */
+    gboolean timezone_changed;
+    gboolean local_rtc_changed;
+    gboolean ntp_changed;
+    gboolean new_local_rtc;
+    const gchar *service;
+};
+
+static void
+apply_settings_unlock (struct invoked_apply_settings *data)
+{
+    async_lock_release (ntp_lock);
+    async_lock_release (clock_lock);
+    async_lock_release (zone_lock);
+    g_free (data->timezone);
+    g_free (data);
+}
+
+/* Once the files are committed, and the rtc follows them */
+static void
+apply_settings_done (gpointer user_data)
+{
+    struct invoked_apply_settings *data;
+
+    data = (struct invoked_apply_settings *) user_data;
+    timedated_timedate1_complete_apply_settings (timedate1, data->invocation);
+    if (data->timezone_changed) {
+        g_free (timezone_name);
+        timezone_name = g_steal_pointer (&data->timezone);
+        timedated_timedate1_set_timezone (timedate1, timezone_name);
+        dst_watch_set_timezone (timezone_name);
+    }
+    if (data->local_rtc_changed) {
+        local_rtc = data->local_rtc;
+        timedated_timedate1_set_local_rtc (timedate1, local_rtc);
+    }
+    if (data->ntp_changed) {
+        use_ntp = data->use_ntp;
+        timedated_timedate1_set_ntp (timedate1, use_ntp);
+    }
+    apply_settings_unlock (data);
+}
+
+/* Each file is staged once, with its final contents; nothing is replaced
+ * unless the ntp service could be switched too */
+static gboolean
+apply_settings_commit (gpointer user_data,
+                       GError **error)
+{
+    struct invoked_apply_settings *data;
+    SettingsTransaction *transaction;
+    gboolean ret = FALSE;
+
+    data = (struct invoked_apply_settings *) user_data;
+    transaction = settings_transaction_new ();
+    if ((data->timezone_changed && !set_timezone (data->timezone, transaction, error)) ||
+        (data->local_rtc_changed && !set_local_rtc_file (data->new_local_rtc, transaction, error)) ||
+        (data->ntp_changed && !switch_ntp_service (data->service, data->use_ntp, error)))
+        goto out;
+
+    if (!settings_transaction_commit (transaction, error)) {
+        GError *ntp_err = NULL;
+
+        if (data->ntp_changed && !switch_ntp_service (data->service, !data->use_ntp, &ntp_err)) {
+            g_warning ("Unable to restore the ntp service: %s", ntp_err->message);
+            g_error_free (ntp_err);
+        }
+        goto out;
+    }
+    ret = TRUE;
+
+  out:
+    settings_transaction_free (transaction);
+    return ret;
+}
+
+static void
+apply_settings_committed (gpointer user_data,
+                          const GError *error)
+{
+    struct invoked_apply_settings *data;
+
+    data = (struct invoked_apply_settings *) user_data;
+    if (error != NULL) {
+        g_dbus_method_invocation_return_gerror (data->invocation, error);
+        apply_settings_unlock (data);
+        return;
+    }
+
+    /* Nothing below can fail; the rtc is touched at most once, against
+     * the final zone and mode */
+    if (data->local_rtc_changed)
+        apply_local_rtc (data->new_local_rtc, data->fix_system, apply_settings_done, data);
+    else if (data->timezone_changed && data->new_local_rtc) {
+        hwclock_apply_localtime_delta (NULL);
+        sync_rtc_from_system (TRUE, apply_settings_done, data);
+    } else
+        apply_settings_done (data);
+}
+
+static void
+apply_settings_locked (gint64 wait,
+                       gpointer user_data)
+{
+    struct invoked_apply_settings *data;
+
+    data = (struct invoked_apply_settings *) user_data;
+    record_queue_wait (WAIT_APPLY_SETTINGS, wait);
+
+    /* Compare against the state as it is now, rather than when the call
+     * was received: another call may have got in while we waited */
+    data->timezone_changed = data->timezone != NULL && g_strcmp0 (data->timezone, timezone_name);
+    data->local_rtc_changed = data->has_local_rtc && data->local_rtc != local_rtc;
+    data->ntp_changed = data->has_ntp && data->use_ntp != use_ntp;
+    data->new_local_rtc = data->has_local_rtc ? data->local_rtc : local_rtc;
+
+    if (data->ntp_changed && (data->service = ntp_service ()) == NULL) {
+        g_dbus_method_invocation_return_dbus_error (data->invocation, DBUS_ERROR_FAILED,
+                                                    "No ntp implementation found. Please install one of the following packages: "
+                                                    NTP_DEFAULT_SERVICES_PACKAGES);
+        apply_settings_unlock (data);
+        return;
+    }
+    run_blocking (apply_settings_commit, apply_settings_committed, data);
+}
+
+static void
+on_handle_apply_settings_authorized_cb (GObject *source_object,
+                                        GAsyncResult *res,
+                                        gpointer user_data)
+{
+    GError *err = NULL;
+    struct invoked_apply_settings *data;
+    AsyncLock *locks[] = { zone_lock, clock_lock, ntp_lock };
+
+    data = (struct invoked_apply_settings *) user_data;
+    if (!check_polkit_finish (res, &err)) {
+        g_dbus_method_invocation_return_gerror (data->invocation, err);
+        g_error_free (err);
+        g_free (data->timezone);
+        g_free (data);
+        return;
+    }
+
+    async_lock_acquire_all_async (locks, G_N_ELEMENTS (locks), CONFIG_PRIORITY, apply_settings_locked, data);
+}
+
+static gboolean
+on_handle_apply_settings (TimedatedTimedate1 *timedate1,
+                          GDBusMethodInvocation *invocation,
+                          GVariant *settings,
+                          const gboolean user_interaction,
+                          gpointer user_data)
+{
+    struct invoked_apply_settings *data;
+    TzCatalog *catalog;
+    GVariantIter iter;
+    const gchar *key;
+    GVariant *value;
+    const gchar *action = NULL;
+
+    if (read_only) {
+        g_dbus_method_invocation_return_dbus_error (invocation,
+                                                    DBUS_ERROR_NOT_SUPPORTED,
+                                                    SERVICE_NAME " is in read-only mode");
+        return TRUE;
+    }
+    if (!check_sender_limit (invocation))
+        return TRUE;
+
+    data = g_new0 (struct invoked_apply_settings, 1);
+    data->invocation = invocation;
+
+    g_variant_iter_init (&iter, settings);
+    while (g_variant_iter_next (&iter, "{&sv}", &key, &value)) {
+        if (!strcmp (key, "Timezone") && g_variant_is_of_type (value, G_VARIANT_TYPE_STRING)) {
+            const gchar *timezone = g_variant_get_string (value, NULL);
+
+            if ((catalog = get_tz_catalog ()) != NULL && !tz_catalog_lookup (catalog, timezone, NULL)) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       G_DBUS_ERROR,
+                                                       G_DBUS_ERROR_INVALID_ARGS,
+                                                       "Invalid or not installed time zone '%s'", timezone);
+                g_variant_unref (value);
+                goto out;
+            }
+            g_free (data->timezone);
+            data->timezone = g_strdup (canonical_timezone (timezone));
+        } else if (!strcmp (key, "LocalRTC") && g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN)) {
+            data->has_local_rtc = TRUE;
+            data->local_rtc = g_variant_get_boolean (value);
+        } else if (!strcmp (key, "FixSystem") && g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
+            data->fix_system = g_variant_get_boolean (value);
+        else if (!strcmp (key, "NTP") && g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN)) {
+            data->has_ntp = TRUE;
+            data->use_ntp = g_variant_get_boolean (value);
+        } else {
+            g_dbus_method_invocation_return_error (invocation,
+                                                   G_DBUS_ERROR,
+                                                   G_DBUS_ERROR_INVALID_ARGS,
+                                                   "Unknown setting '%s' of type '%s'",
+                                                   key, g_variant_get_type_string (value));
+            g_variant_unref (value);
+            goto out;
+        }
+        g_variant_unref (value);
+    }
+
+    /* One authorization covers the whole call, so ask for the strongest
+     * of the actions that would be performed separately */
+    if (data->has_local_rtc && data->local_rtc != local_rtc)
+        action = "org.freedesktop.timedate1.set-local-rtc";
+    else if (data->timezone != NULL && g_strcmp0 (data->timezone, timezone_name))
+        action = "org.freedesktop.timedate1.set-timezone";
+    else if (data->has_ntp && data->use_ntp != use_ntp)
+        action = "org.freedesktop.timedate1.set-ntp";
+
+    if (action == NULL) {
+        /* Everything is already as requested */
+        timedated_timedate1_complete_apply_settings (timedate1, invocation);
+        goto out;
     }
 
+    check_authorization_async (invocation, action, user_interaction, on_handle_apply_settings_authorized_cb, data);
+    return TRUE;
+
+  out:
+    g_free (data->timezone);
+    g_free (data);
     return TRUE;
 }
 
+static void
+dst_transition_locked (gint64 wait,
+                       gpointer user_data)
+{
+    if (local_rtc) {
+        /* The kernel's view of the rtc timezone is stale once the UTC
+         * offset changed; update it and resync the rtc */
+        hwclock_apply_localtime_delta (NULL);
+        sync_rtc_from_system (TRUE, release_clock_lock, NULL);
+    } else
+        async_lock_release (clock_lock);
+}
+
+static void
+on_dst_transition (gint64 transition,
+                   const TzOffset *offset,
+                   gpointer user_data)
+{
+    /* Still signalled in read-only mode, where the clocks are left alone */
+    if (!read_only)
+        async_lock_acquire_async (clock_lock, CONFIG_PRIORITY, dst_transition_locked, NULL);
+
+    if (timedate1 != NULL)
+        timedated_timedate1_emit_offset_changed (timedate1, offset->utc_offset, offset->is_dst, offset->abbreviation);
+}
+
+/* The skeleton generated by gdbus-codegen stores property values; this
+ * subclass computes the ones below on each Get or GetAll instead */
+typedef struct {
+    TimedatedTimedate1Skeleton parent_instance;
+} TimedatedLazySkeleton;
+
+typedef struct {
+    TimedatedTimedate1SkeletonClass parent_class;
+} TimedatedLazySkeletonClass;
+
+G_DEFINE_TYPE (TimedatedLazySkeleton, timedated_lazy_skeleton, TIMEDATED_TYPE_TIMEDATE1_SKELETON)
+
+static void
+timedated_lazy_skeleton_get_property (GObject *object,
+                                      guint prop_id,
+                                      GValue *value,
+                                      GParamSpec *pspec)
+{
+    if (!strcmp (pspec->name, "time-usec"))
+        g_value_set_uint64 (value, g_get_real_time ());
+    else if (!strcmp (pspec->name, "rtctime-usec")) {
+        gint64 rtc;
+
+        if (async_lock_try_acquire (clock_lock)) {
+            rtc = get_rtc_time_cached ();
+            async_lock_release (clock_lock);
+        } else if (rtc_cache_valid && rtc_cache_value >= 0)
+            /* The rtc is busy: extrapolate the last reading */
+            rtc = rtc_cache_value + (g_get_monotonic_time () - rtc_cache_monotonic);
+        else
+            rtc = -1;
+        g_value_set_uint64 (value, rtc >= 0 ? rtc : 0);
+    } else if (!strcmp (pspec->name, "ntpsynchronized"))
+        g_value_set_boolean (value, ntp_synchronized ());
+    else if (!strcmp (pspec->name, "can-ntp"))
+        g_value_set_boolean (value, ntp_service () != NULL);
+    else if (!strcmp (pspec->name, "clock-thread-latency"))
+        g_value_set_variant (value, clock_thread_get_latency ());
+    else
+        G_OBJECT_CLASS (timedated_lazy_skeleton_parent_class)->get_property (object, prop_id, value, pspec);
+}
+
+static void
+timedated_lazy_skeleton_init (TimedatedLazySkeleton *skeleton)
+{
+}
+
+static void
+timedated_lazy_skeleton_class_init (TimedatedLazySkeletonClass *klass)
+{
+    G_OBJECT_CLASS (klass)->get_property = timedated_lazy_skeleton_get_property;
+}
+
 static void
 on_bus_acquired (GDBusConnection *connection,
                  const gchar     *bus_name,
@@ -680,16 +2338,22 @@ on_bus_acquired (GDBusConnection *connection,
 
     g_debug ("Acquired a message bus connection");
 
-    timedate1 = timedated_timedate1_skeleton_new ();
+    timedate1 = TIMEDATED_TIMEDATE1 (g_object_new (timedated_lazy_skeleton_get_type (), NULL));
 
     timedated_timedate1_set_timezone (timedate1, timezone_name);
     timedated_timedate1_set_local_rtc (timedate1, local_rtc);
     timedated_timedate1_set_ntp (timedate1, use_ntp);
+    update_slew_properties (slew_remaining ());
 
     g_signal_connect (timedate1, "handle-set-time", G_CALLBACK (on_handle_set_time), NULL);
     g_signal_connect (timedate1, "handle-set-timezone", G_CALLBACK (on_handle_set_timezone), NULL);
     g_signal_connect (timedate1, "handle-set-local-rtc", G_CALLBACK (on_handle_set_local_rtc), NULL);
     g_signal_connect (timedate1, "handle-set-ntp", G_CALLBACK (on_handle_set_ntp), NULL);
+    g_signal_connect (timedate1, "handle-apply-settings", G_CALLBACK (on_handle_apply_settings), NULL);
+    g_signal_connect (timedate1, "handle-list-timezones", G_CALLBACK (on_handle_list_timezones), NULL);
+    g_signal_connect (timedate1, "handle-search-timezones", G_CALLBACK (on_handle_search_timezones), NULL);
+    g_signal_connect (timedate1, "handle-get-timezone-offsets", G_CALLBACK (on_handle_get_timezone_offsets), NULL);
+    g_signal_connect (timedate1, "handle-get-time-info", G_CALLBACK (on_handle_get_time_info), NULL);
 
     if (!g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (timedate1),
                                            connection,
@@ -723,29 +2387,181 @@ on_name_lost (GDBusConnection *connection,
     exit (1);
 }
 
+static void
+clock_step_locked (gint64 wait,
+                   gpointer user_data)
+{
+    gboolean own;
+
+    /* A step of ours leaves the clocks as far apart as right after it;
+     * another program stepping the clock in between, or instead, does
+     * not. The clock lock was held from our step until the token was
+     * set, so this runs after it even when the watch fired first. */
+    own = own_step_pending && ABS (clock_step_realtime_offset () - own_step_offset) <= OWN_STEP_TOLERANCE;
+    own_step_pending = FALSE;
+
+    /* With NTP, the kernel's 11 minute mode keeps the rtc in sync */
+    if (!own && !use_ntp) {
+        sync_rtc_from_system (local_rtc, release_clock_lock, NULL);
+        return;
+    }
+    async_lock_release (clock_lock);
+}
+
+static void
+on_clock_step (gpointer user_data)
+{
+    /* The rtc follows the steps made by other programs, but not in
+     * read-only mode */
+    if (!read_only)
+        async_lock_acquire_async (clock_lock, CONFIG_PRIORITY, clock_step_locked, NULL);
+
+    /* The next UTC offset change may not be the one the timer waits for */
+    dst_watch_rearm ();
+
+    if (timedate1 != NULL)
+        timedated_timedate1_emit_time_changed (timedate1);
+}
+
+static void
+rtc_device_changed_locked (gint64 wait,
+                           gpointer user_data)
+{
+    hwclock_invalidate_device ();
+    rtc_mirror_refresh ();
+    rtc_cache_valid = FALSE;
+    async_lock_release (clock_lock);
+}
+
+static void
+on_rtc_device_changed (const gchar *action,
+                       const gchar *devpath,
+                       gpointer user_data)
+{
+    async_lock_acquire_async (clock_lock, CONFIG_PRIORITY, rtc_device_changed_locked, NULL);
+}
+
+static void
+select_rtc_backend (GKeyFile *config)
+{
+    RtcFakeParameters fake;
+    gchar *name = NULL;
+
+    if (config != NULL)
+        name = g_key_file_get_string (config, "settings", "rtcbackend", NULL);
+    if (name == NULL || !strcmp (name, "ioctl"))
+        goto out;
+    if (strcmp (name, "fake")) {
+        g_warning ("Unknown rtc backend %s, using ioctl", name);
+        goto out;
+    }
+
+    memset (&fake, 0, sizeof (fake));
+    fake.latency = config_get_integer (config, "rtcfakelatency", 0, 0, G_USEC_PER_SEC);
+    fake.fail_percent = config_get_integer (config, "rtcfakefailrate", 0, 0, 100);
+    fake.drift_ppm = config_get_integer (config, "rtcfakedrift", 0, -1000, 1000);
+    fake.update_irq = config_get_boolean (config, "rtcfakeinterrupts", TRUE);
+    hwclock_set_backend (rtc_fake_init (&fake));
+    g_message ("Using fake rtcs, the hardware clock is not touched");
+
+  out:
+    g_free (name);
+}
+
+static SettingsDurability
+select_durability (GKeyFile *config)
+{
+    SettingsDurability durability = SETTINGS_DURABILITY_FULL;
+    gchar *name = NULL;
+
+    if (config != NULL)
+        name = g_key_file_get_string (config, "settings", "durability", NULL);
+    if (name == NULL || !strcmp (name, "full"))
+        goto out;
+    if (!strcmp (name, "data"))
+        durability = SETTINGS_DURABILITY_DATA;
+    else if (!strcmp (name, "none"))
+        durability = SETTINGS_DURABILITY_NONE;
+    else
+        g_warning ("Unknown durability %s, using full", name);
+
+  out:
+    g_free (name);
+    return durability;
+}
+
 void
 timedated_init (gboolean _read_only,
-                const gchar *_ntp_preferred_service)
+                const gchar *_ntp_preferred_service,
+                GKeyFile *config)
 {
     GError *err = NULL;
+    gint rtc_drift_interval;
+    gint clock_thread_priority;
+    gint burst;
 
     read_only = _read_only;
     ntp_preferred_service = _ntp_preferred_service;
 
+    zone_lock = async_lock_new ("zone");
+    clock_lock = async_lock_new ("clock");
+    ntp_lock = async_lock_new ("ntp");
+
+    select_rtc_backend (config);
+    rtc_accurate = config_get_boolean (config, "rtcaccurate", FALSE);
+    rtc_timeout = config_get_integer (config, "rtctimeout", DEFAULT_RTC_TIMEOUT_MSEC, 1, MAX_RTC_TIMEOUT_MSEC) * G_TIME_SPAN_MILLISECOND;
+    slew_threshold = config_get_integer (config, "slewthreshold", 0, 0, MAX_SLEW_THRESHOLD_MSEC) * G_TIME_SPAN_MILLISECOND;
+    clock_thread_priority = config_get_integer (config, "clockthread", 0, 0, CLOCK_THREAD_MAX_PRIORITY);
+    if (clock_thread_priority > 0 && !read_only)
+        clock_thread_init (clock_thread_priority);
+    burst = config_get_integer (config, "ratelimitburst", DEFAULT_RATE_LIMIT_BURST, 0, MAX_RATE_LIMIT_BURST);
+    if (burst > 0)
+        sender_limit = rate_limit_new (burst,
+                                       config_get_integer (config, "ratelimitrate", DEFAULT_RATE_LIMIT_RATE, 1, MAX_RATE_LIMIT_RATE),
+                                       MAX_RATE_LIMIT_KEYS);
+    burst = config_get_integer (config, "ratelimituserburst", DEFAULT_RATE_LIMIT_USER_BURST, 0, MAX_RATE_LIMIT_BURST);
+    if (burst > 0)
+        user_limit = rate_limit_new (burst,
+                                     config_get_integer (config, "ratelimituserrate", DEFAULT_RATE_LIMIT_USER_RATE, 1, MAX_RATE_LIMIT_RATE),
+                                     MAX_RATE_LIMIT_KEYS);
+    if (config != NULL) {
+        gchar *rtc_device = g_key_file_get_string (config, "settings", "rtcdevice", NULL);
+        gchar **rtc_mirrors = g_key_file_get_string_list (config, "settings", "rtcmirrors", NULL, NULL);
+
+        rtc_mirror_init (rtc_device, rtc_mirrors);
+        g_free (rtc_device);
+        g_strfreev (rtc_mirrors);
+    } else
+        rtc_mirror_init (NULL, NULL);
+
     hwclock_file = g_file_new_for_path (SYSCONFDIR "/conf.d/hwclock");
     timezone_file = g_file_new_for_path (SYSCONFDIR "/timezone");
     localtime_file = g_file_new_for_path (SYSCONFDIR "/localtime");
 
+    /* Settle an interrupted write before reading the settings */
+    if (!read_only)
+        settings_journal_init (SETTINGS_JOURNAL, select_durability (config));
+
     local_rtc = get_local_rtc (&err);
     if (err != NULL) {
         g_debug ("%s", err->message);
         g_clear_error (&err);
     }
+    rtc_drift_interval = config_get_integer (config, "rtcdriftinterval", 0, 0, MAX_RTC_DRIFT_INTERVAL);
+    if (rtc_drift_interval != 0 && rtc_drift_interval < MIN_RTC_DRIFT_INTERVAL) {
+        g_warning ("rtcdriftinterval raised to %d seconds", MIN_RTC_DRIFT_INTERVAL);
+        rtc_drift_interval = MIN_RTC_DRIFT_INTERVAL;
+    }
+    rtc_drift_init (ADJTIME, rtc_drift_interval, on_rtc_drift_sample, NULL);
+    tz_file_cache_init (ZONEINFODIR);
     timezone_name = get_timezone_name (&err);
     if (err != NULL) {
         g_warning ("%s", err->message);
         g_clear_error (&err);
     }
+    dst_watch_init (timezone_name, on_dst_transition, NULL);
+    rtc_watch_init (on_rtc_device_changed, NULL);
+    clock_watch_init (on_clock_step, NULL);
     if (ntp_service () == NULL) {
         g_warning ("No ntp implementation found. Please install one of the following packages: " NTP_DEFAULT_SERVICES_PACKAGES);
         use_ntp = FALSE;
@@ -770,12 +2586,48 @@ timedated_init (gboolean _read_only,
 void
 timedated_destroy (void)
 {
+    guint i;
+
     g_bus_unown_name (bus_id);
     bus_id = 0;
     read_only = FALSE;
     ntp_preferred_service = NULL;
 
+    /* Lets a SetTime in the clock thread finish; its completion still
+     * writes the rtc */
+    clock_thread_destroy ();
+    /* Lets the rtc jobs and the settings commits complete, and the calls
+     * waiting for them, while everything they use is still there */
+    while (rtc_jobs > 0 || blocking_calls > 0)
+        g_main_context_iteration (NULL, TRUE);
+
     g_object_unref (hwclock_file);
     g_object_unref (timezone_file);
     g_object_unref (localtime_file);
+    g_clear_pointer (&tz_catalog, tz_catalog_free);
+    /* Saves /etc/adjtime through the settings journal */
+    rtc_drift_destroy ();
+    settings_journal_destroy ();
+    dst_watch_destroy ();
+    rtc_watch_destroy ();
+    clock_watch_destroy ();
+    rtc_mirror_destroy ();
+    if (slew_source_id != 0) {
+        g_source_remove (slew_source_id);
+        slew_source_id = 0;
+    }
+    hwclock_set_backend (NULL);
+    rtc_fake_destroy ();
+    tz_file_cache_destroy ();
+    hwclock_invalidate_device ();
+    for (i = 0; i < N_WAITS; i++)
+        if (queue_waits[i].calls > 0)
+            g_debug ("%s: %" G_GUINT64_FORMAT " calls waited a mean %" G_GINT64_FORMAT " us, max %" G_GINT64_FORMAT " us, for the locks",
+                     queue_wait_methods[i], queue_waits[i].calls,
+                     queue_waits[i].total / (gint64) queue_waits[i].calls, queue_waits[i].max);
+    g_clear_pointer (&sender_limit, rate_limit_free);
+    g_clear_pointer (&user_limit, rate_limit_free);
+    g_clear_pointer (&ntp_lock, async_lock_free);
+    g_clear_pointer (&clock_lock, async_lock_free);
+    g_clear_pointer (&zone_lock, async_lock_free);
 }
@@ -23,7 +23,8 @@
 
 void
 timedated_init (gboolean read_only,
-                const gchar *_ntp_preferred_service);
+                const gchar *_ntp_preferred_service,
+                GKeyFile *config);
 
 void
 timedated_destroy (void);
@@ -0,0 +1,717 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "tzcatalog.h"
+
+#include "config.h"
+
+/*
+  Layout of the cache file (native endianness, it is never shared between
+  hosts):
+
+    struct tz_catalog_header
+    guint32 offsets[n_zones]     offset of each name in the blob
+    guint32 canonical[n_zones]   index of the zone each name links to,
+                                 or of itself if it is not a link
+    gchar blob[blob_size]        sorted, NUL separated names
+
+  The file is mapped read-only, and the names handed out by the catalog
+  point directly into the mapping.
+*/
+
+#define TZ_CATALOG_MAGIC "TZCAT\0\0\3"
+
+struct tz_catalog_header {
+    gchar magic[8];
+    gint64 source_mtime;
+    guint32 n_zones;
+    guint32 blob_size;
+};
+
+struct tz_search_entry {
+    guint32 key;  /* offset in normalized */
+    guint32 zone; /* index in zones */
+};
+
+struct _TzCatalog {
+    gchar *zoneinfo_dir;
+    gint64 source_mtime;
+
+    GMappedFile *mapped; /* backing store when loaded from the cache */
+    gchar *blob;         /* backing store when freshly built */
+
+    guint n_zones;
+    const gchar **zones; /* NULL terminated, points into the backing store */
+    guint32 *canonical;  /* link -> canonical zone, by index */
+
+    /* Search index, built on first use */
+    gchar *normalized;               /* normalized zones, NUL separated */
+    guint32 *normalized_offsets;
+    struct tz_search_entry *entries; /* sorted by key */
+    guint n_entries;
+};
+
+/* Files whose modification invalidates the catalog. The directory itself
+ * is included so that zones added without a tzdata.zi are noticed. */
+static const gchar *source_files[] = { "", "tzdata.zi", "zone1970.tab", "zone.tab", NULL };
+
+static gint64
+tz_catalog_source_mtime (const gchar *zoneinfo_dir)
+{
+    const gchar **s;
+    gint64 ret = 0;
+
+    for (s = source_files; *s != NULL; s++) {
+        g_autofree gchar *filename = g_build_filename (zoneinfo_dir, *s, NULL);
+        struct stat st;
+
+        if (g_stat (filename, &st) < 0)
+            continue;
+        ret = MAX (ret, (gint64) st.st_mtim.tv_sec * G_GINT64_CONSTANT (1000000000) + st.st_mtim.tv_nsec);
+    }
+    return ret;
+}
+
+static void
+add_names_from_tzdata_zi (GHashTable *names,
+                          GHashTable *links,
+                          const gchar *contents)
+{
+    g_auto(GStrv) lines = g_strsplit (contents, "\n", -1);
+    gchar **line;
+
+    /* "Z NAME ..." declares a zone, "L TARGET NAME" a link */
+    for (line = lines; *line != NULL; line++) {
+        g_auto(GStrv) fields = NULL;
+
+        if (((*line)[0] != 'Z' && (*line)[0] != 'L') || (*line)[1] != ' ')
+            continue;
+        fields = g_strsplit_set (*line, " \t", -1);
+        if ((*line)[0] == 'Z' && g_strv_length (fields) >= 2)
+            g_hash_table_add (names, g_strdup (fields[1]));
+        else if ((*line)[0] == 'L' && g_strv_length (fields) >= 3) {
+            g_hash_table_add (names, g_strdup (fields[2]));
+            g_hash_table_insert (links, g_strdup (fields[2]), g_strdup (fields[1]));
+        }
+    }
+}
+
+static void
+add_names_from_zone_tab (GHashTable *names,
+                         const gchar *contents)
+{
+    g_auto(GStrv) lines = g_strsplit (contents, "\n", -1);
+    gchar **line;
+
+    /* Tab separated: country code(s), coordinates, TZ, comments */
+    for (line = lines; *line != NULL; line++) {
+        g_auto(GStrv) fields = NULL;
+
+        if ((*line)[0] == '#' || (*line)[0] == 0)
+            continue;
+        fields = g_strsplit (*line, "\t", 4);
+        if (g_strv_length (fields) >= 3)
+            g_hash_table_add (names, g_strdup (fields[2]));
+    }
+}
+
+static gboolean
+is_tzif_file (const gchar *filename)
+{
+    gchar magic[4];
+    gboolean ret = FALSE;
+    FILE *f;
+
+    if ((f = fopen (filename, "re")) == NULL)
+        return FALSE;
+    if (fread (magic, 1, sizeof (magic), f) == sizeof (magic))
+        ret = memcmp (magic, "TZif", sizeof (magic)) == 0;
+    fclose (f);
+    return ret;
+}
+
+/* tzdata.zi does not say which file a link comes from: besides the
+ * "backward" aliases, it links zones which merely share their rules
+ * since 1970, such as Europe/Oslo to Europe/Berlin. Those are still
+ * zones of their own, listed in zone.tab for their country, while the
+ * aliases never are; drop them from @links. */
+static void
+remove_located_links (GHashTable *links,
+                      const gchar *zoneinfo_dir)
+{
+    g_autoptr(GHashTable) located = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    const gchar *tabs[] = { "zone1970.tab", "zone.tab", NULL };
+    const gchar **tab;
+    GHashTableIter iter;
+    gpointer name;
+
+    for (tab = tabs; *tab != NULL; tab++) {
+        g_autofree gchar *filename = g_build_filename (zoneinfo_dir, *tab, NULL);
+        g_autofree gchar *contents = NULL;
+
+        if (g_file_get_contents (filename, &contents, NULL, NULL))
+            add_names_from_zone_tab (located, contents);
+    }
+
+    g_hash_table_iter_init (&iter, located);
+    while (g_hash_table_iter_next (&iter, &name, NULL))
+        g_hash_table_remove (links, name);
+}
+
+static void
+add_names_from_tree (GHashTable *names,
+                     const gchar *zoneinfo_dir,
+                     const gchar *prefix)
+{
+    g_autofree gchar *dirname = NULL;
+    const gchar *entry;
+    GDir *dir;
+
+    dirname = prefix == NULL ? g_strdup (zoneinfo_dir) : g_build_filename (zoneinfo_dir, prefix, NULL);
+    if ((dir = g_dir_open (dirname, 0, NULL)) == NULL)
+        return;
+
+    while ((entry = g_dir_read_name (dir)) != NULL) {
+        g_autofree gchar *name = NULL, *filename = NULL;
+
+        /* posix/ and right/ duplicate the whole tree, and these two are
+         * not zones even though they are TZif files */
+        if (prefix == NULL && (!g_strcmp0 (entry, "posix") || !g_strcmp0 (entry, "right") ||
+                               !g_strcmp0 (entry, "posixrules") || !g_strcmp0 (entry, "localtime")))
+            continue;
+
+        name = prefix == NULL ? g_strdup (entry) : g_build_filename (prefix, entry, NULL);
+        filename = g_build_filename (zoneinfo_dir, name, NULL);
+        if (g_file_test (filename, G_FILE_TEST_IS_DIR))
+            add_names_from_tree (names, zoneinfo_dir, name);
+        else if (is_tzif_file (filename))
+            g_hash_table_add (names, g_steal_pointer (&name));
+    }
+    g_dir_close (dir);
+}
+
+static gint
+compare_names (gconstpointer a,
+               gconstpointer b)
+{
+    return strcmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+static void
+tz_catalog_set_zones (TzCatalog *catalog,
+                      const guint32 *offsets,
+                      const gchar *blob)
+{
+    guint i;
+
+    catalog->zones = g_new0 (const gchar *, catalog->n_zones + 1);
+    for (i = 0; i < catalog->n_zones; i++)
+        catalog->zones[i] = blob + offsets[i];
+}
+
+/* Follow the backward compatible links of each zone down to the zone it
+ * is an alias for */
+static void
+tz_catalog_set_canonical (TzCatalog *catalog,
+                          GHashTable *links)
+{
+    guint i;
+
+    catalog->canonical = g_new (guint32, catalog->n_zones);
+    for (i = 0; i < catalog->n_zones; i++) {
+        const gchar *name = catalog->zones[i], *target;
+        guint depth, index = i;
+
+        /* tzdata does not chain links, but be lenient and bounded */
+        for (depth = 0; depth < 8 && (target = g_hash_table_lookup (links, name)) != NULL; depth++)
+            name = target;
+        if (name != catalog->zones[i] && !tz_catalog_lookup (catalog, name, &index))
+            index = i;
+        catalog->canonical[i] = index;
+    }
+}
+
+static gboolean
+tz_catalog_load_cache (TzCatalog *catalog,
+                       const gchar *cache_filename)
+{
+    g_autoptr(GError) err = NULL;
+    const struct tz_catalog_header *header;
+    const guint32 *offsets, *canonical;
+    const gchar *contents, *blob;
+    gsize length;
+    guint i;
+
+    if ((catalog->mapped = g_mapped_file_new (cache_filename, FALSE, &err)) == NULL) {
+        g_debug ("No usable time zone cache %s: %s", cache_filename, err->message);
+        return FALSE;
+    }
+
+    contents = g_mapped_file_get_contents (catalog->mapped);
+    length = g_mapped_file_get_length (catalog->mapped);
+    header = (const struct tz_catalog_header *) contents;
+    if (length < sizeof (*header) || memcmp (header->magic, TZ_CATALOG_MAGIC, sizeof (header->magic)))
+        goto invalid;
+    if (header->source_mtime != catalog->source_mtime) {
+        g_debug ("Time zone cache %s is out of date", cache_filename);
+        goto invalid;
+    }
+    if (header->blob_size == 0 ||
+        length != sizeof (*header) + (gsize) header->n_zones * 2 * sizeof (guint32) + header->blob_size)
+        goto invalid;
+
+    offsets = (const guint32 *) (contents + sizeof (*header));
+    canonical = offsets + header->n_zones;
+    blob = (const gchar *) (canonical + header->n_zones);
+    if (blob[header->blob_size - 1] != 0)
+        goto invalid;
+    for (i = 0; i < header->n_zones; i++)
+        if (offsets[i] >= header->blob_size || canonical[i] >= header->n_zones)
+            goto invalid;
+
+    catalog->n_zones = header->n_zones;
+    tz_catalog_set_zones (catalog, offsets, blob);
+    catalog->canonical = g_new (guint32, catalog->n_zones);
+    memcpy (catalog->canonical, canonical, catalog->n_zones * sizeof (guint32));
+    return TRUE;
+
+  invalid:
+    g_debug ("Discarding time zone cache %s", cache_filename);
+    g_clear_pointer (&catalog->mapped, g_mapped_file_unref);
+    return FALSE;
+}
+
+static gboolean
+tz_catalog_build (TzCatalog *catalog,
+                  const gchar *cache_filename,
+                  GError **error)
+{
+    g_autoptr(GHashTable) names = NULL;
+    g_autoptr(GHashTable) links = NULL;
+    g_autoptr(GPtrArray) sorted = NULL;
+    g_autoptr(GArray) offsets = NULL;
+    g_autoptr(GString) blob = NULL;
+    g_autoptr(GString) cache = NULL;
+    g_autofree gchar *filename = NULL, *contents = NULL, *cache_dir = NULL;
+    GHashTableIter iter;
+    struct tz_catalog_header header;
+    gpointer name;
+    guint i;
+
+    names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    links = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+    filename = g_build_filename (catalog->zoneinfo_dir, "tzdata.zi", NULL);
+    if (g_file_get_contents (filename, &contents, NULL, NULL)) {
+        add_names_from_tzdata_zi (names, links, contents);
+        remove_located_links (links, catalog->zoneinfo_dir);
+    } else {
+        const gchar *tabs[] = { "zone1970.tab", "zone.tab", NULL };
+        const gchar **tab;
+
+        for (tab = tabs; *tab != NULL; tab++) {
+            g_clear_pointer (&filename, g_free);
+            g_clear_pointer (&contents, g_free);
+            filename = g_build_filename (catalog->zoneinfo_dir, *tab, NULL);
+            if (g_file_get_contents (filename, &contents, NULL, NULL))
+                add_names_from_zone_tab (names, contents);
+        }
+    }
+    if (g_hash_table_size (names) == 0)
+        add_names_from_tree (names, catalog->zoneinfo_dir, NULL);
+
+    /* Only keep what set_localtime_file will actually be able to use */
+    sorted = g_ptr_array_sized_new (g_hash_table_size (names));
+    g_hash_table_iter_init (&iter, names);
+    while (g_hash_table_iter_next (&iter, &name, NULL)) {
+        g_autofree gchar *zone_filename = g_build_filename (catalog->zoneinfo_dir, name, NULL);
+
+        if (strstr (name, "..") == NULL && g_file_test (zone_filename, G_FILE_TEST_IS_REGULAR))
+            g_ptr_array_add (sorted, name);
+    }
+    if (sorted->len == 0) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "No time zones found in '%s'", catalog->zoneinfo_dir);
+        return FALSE;
+    }
+    g_ptr_array_sort (sorted, compare_names);
+
+    /* The hash table already removed duplicates */
+    offsets = g_array_sized_new (FALSE, FALSE, sizeof (guint32), sorted->len);
+    blob = g_string_new (NULL);
+    for (i = 0; i < sorted->len; i++) {
+        guint32 offset = blob->len;
+
+        g_array_append_val (offsets, offset);
+        g_string_append_len (blob, g_ptr_array_index (sorted, i), strlen (g_ptr_array_index (sorted, i)) + 1);
+    }
+
+    catalog->n_zones = offsets->len;
+    catalog->blob = g_malloc (blob->len);
+    memcpy (catalog->blob, blob->str, blob->len);
+    tz_catalog_set_zones (catalog, (const guint32 *) offsets->data, catalog->blob);
+    tz_catalog_set_canonical (catalog, links);
+    g_debug ("Built catalog of %u time zones (%u links) from %s",
+             catalog->n_zones, g_hash_table_size (links), catalog->zoneinfo_dir);
+
+    if (cache_filename == NULL)
+        return TRUE;
+
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, TZ_CATALOG_MAGIC, sizeof (header.magic));
+    header.source_mtime = catalog->source_mtime;
+    header.n_zones = catalog->n_zones;
+    header.blob_size = blob->len;
+
+    cache = g_string_sized_new (sizeof (header) + offsets->len * 2 * sizeof (guint32) + blob->len);
+    g_string_append_len (cache, (const gchar *) &header, sizeof (header));
+    g_string_append_len (cache, offsets->data, offsets->len * sizeof (guint32));
+    g_string_append_len (cache, (const gchar *) catalog->canonical, catalog->n_zones * sizeof (guint32));
+    g_string_append_len (cache, blob->str, blob->len);
+
+    /* Failing to write the cache only costs a rebuild on the next start */
+    cache_dir = g_path_get_dirname (cache_filename);
+    if (g_mkdir_with_parents (cache_dir, 0755) < 0 ||
+        !g_file_set_contents (cache_filename, cache->str, cache->len, NULL))
+        g_debug ("Unable to write time zone cache %s", cache_filename);
+
+    return TRUE;
+}
+
+/**
+ * tz_catalog_new:
+ * @zoneinfo_dir: the directory holding the compiled time zones
+ * @cache_filename: (nullable): where to persist the catalog
+ * @error: set if no time zone could be found
+ *
+ * Map the catalog from @cache_filename if it is up to date with respect
+ * to the tzdata sources, or build it and write it back to @cache_filename.
+ *
+ * Returns: (nullable): a new catalog. Free with #tz_catalog_free
+ */
+
+TzCatalog *
+tz_catalog_new (const gchar *zoneinfo_dir,
+                const gchar *cache_filename,
+                GError **error)
+{
+    TzCatalog *catalog;
+
+    g_return_val_if_fail (zoneinfo_dir != NULL, NULL);
+
+    catalog = g_new0 (TzCatalog, 1);
+    catalog->zoneinfo_dir = g_strdup (zoneinfo_dir);
+    catalog->source_mtime = tz_catalog_source_mtime (zoneinfo_dir);
+
+    if (cache_filename != NULL && tz_catalog_load_cache (catalog, cache_filename))
+        return catalog;
+
+    if (!tz_catalog_build (catalog, cache_filename, error)) {
+        tz_catalog_free (catalog);
+        return NULL;
+    }
+    return catalog;
+}
+
+void
+tz_catalog_free (TzCatalog *catalog)
+{
+    if (catalog == NULL)
+        return;
+
+    g_free (catalog->zoneinfo_dir);
+    g_free (catalog->zones);
+    g_free (catalog->canonical);
+    g_free (catalog->normalized);
+    g_free (catalog->normalized_offsets);
+    g_free (catalog->entries);
+    g_free (catalog->blob);
+    if (catalog->mapped != NULL)
+        g_mapped_file_unref (catalog->mapped);
+    g_free (catalog);
+}
+
+/**
+ * tz_catalog_is_stale:
+ * @catalog: a catalog
+ *
+ * Returns: %TRUE if tzdata was updated since @catalog was built
+ */
+
+gboolean
+tz_catalog_is_stale (TzCatalog *catalog)
+{
+    g_return_val_if_fail (catalog != NULL, TRUE);
+
+    return tz_catalog_source_mtime (catalog->zoneinfo_dir) != catalog->source_mtime;
+}
+
+guint
+tz_catalog_get_n_zones (TzCatalog *catalog)
+{
+    g_return_val_if_fail (catalog != NULL, 0);
+
+    return catalog->n_zones;
+}
+
+/**
+ * tz_catalog_get_zones:
+ * @catalog: a catalog
+ *
+ * Returns: (transfer none): the sorted, %NULL terminated list of zones
+ */
+
+const gchar * const *
+tz_catalog_get_zones (TzCatalog *catalog)
+{
+    g_return_val_if_fail (catalog != NULL, NULL);
+
+    return catalog->zones;
+}
+
+/**
+ * tz_catalog_lookup:
+ * @catalog: a catalog
+ * @identifier: a time zone identifier, such as "Europe/Paris"
+ * @index: (out) (optional): position of @identifier in the catalog
+ *
+ * Binary search for @identifier.
+ *
+ * Returns: %TRUE if @identifier is a known time zone
+ */
+
+gboolean
+tz_catalog_lookup (TzCatalog *catalog,
+                   const gchar *identifier,
+                   guint *index)
+{
+    guint lo = 0, hi;
+
+    g_return_val_if_fail (catalog != NULL, FALSE);
+
+    if (identifier == NULL)
+        return FALSE;
+
+    hi = catalog->n_zones;
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        gint cmp = strcmp (identifier, catalog->zones[mid]);
+
+        if (cmp == 0) {
+            if (index != NULL)
+                *index = mid;
+            return TRUE;
+        }
+        if (cmp < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return FALSE;
+}
+
+/**
+ * tz_catalog_canonicalize:
+ * @catalog: a catalog
+ * @identifier: a time zone identifier, such as "US/Eastern"
+ *
+ * Resolve backward compatible links, such as US/Eastern, to the zone
+ * they stand for. Zones which merely share their rules with another one
+ * since 1970, such as Europe/Oslo, are their own canonical zone.
+ *
+ * Returns: (transfer none) (nullable): the canonical identifier for
+ * @identifier (e.g. "America/New_York"), @identifier itself if it is not
+ * a link, or %NULL if @identifier is not a known zone
+ */
+
+const gchar *
+tz_catalog_canonicalize (TzCatalog *catalog,
+                         const gchar *identifier)
+{
+    guint index;
+
+    g_return_val_if_fail (catalog != NULL, NULL);
+
+    if (!tz_catalog_lookup (catalog, identifier, &index))
+        return NULL;
+    return catalog->zones[catalog->canonical[index]];
+}
+
+/*
+  Search index: every zone is reachable through its full identifier and
+  through each component after the area, so that "Europe/Paris" is found
+  with "eur", "europe/pa" or "par", and "America/Argentina/Buenos_Aires"
+  with "argentina/b" or "buenos". Links are part of the catalog, so the
+  aliases (e.g. "US/Eastern") are indexed the same way. Keys are lower
+  case, with '_' folded to ' ', and sorted so that all the keys starting
+  with a given prefix are contiguous.
+*/
+
+/* Write the normalized form of @s into @buf; return FALSE if it does not fit */
+static gboolean
+normalize_key (const gchar *s,
+               gchar *buf,
+               gsize size)
+{
+    gsize i;
+
+    for (i = 0; s[i] != 0; i++) {
+        if (i + 1 >= size)
+            return FALSE;
+        buf[i] = s[i] == '_' ? ' ' : g_ascii_tolower (s[i]);
+    }
+    buf[i] = 0;
+    return TRUE;
+}
+
+static gint
+compare_entries (gconstpointer a,
+                 gconstpointer b,
+                 gpointer normalized)
+{
+    const struct tz_search_entry *ea = a, *eb = b;
+    gint cmp = strcmp ((const gchar *) normalized + ea->key, (const gchar *) normalized + eb->key);
+
+    return cmp != 0 ? cmp : (gint) ea->zone - (gint) eb->zone;
+}
+
+static void
+tz_catalog_build_index (TzCatalog *catalog)
+{
+    g_autoptr(GArray) entries = NULL;
+    GString *normalized;
+    guint i;
+
+    /* Every key is a suffix of a normalized zone, so keys point into the
+     * normalized blob and need no storage of their own */
+    normalized = g_string_new (NULL);
+    catalog->normalized_offsets = g_new (guint32, catalog->n_zones);
+    entries = g_array_new (FALSE, FALSE, sizeof (struct tz_search_entry));
+    for (i = 0; i < catalog->n_zones; i++) {
+        const gchar *zone = catalog->zones[i];
+        struct tz_search_entry entry;
+        const gchar *slash;
+        guint32 offset = normalized->len;
+        gsize j;
+
+        catalog->normalized_offsets[i] = offset;
+        for (j = 0; zone[j] != 0; j++)
+            g_string_append_c (normalized, zone[j] == '_' ? ' ' : g_ascii_tolower (zone[j]));
+        g_string_append_c (normalized, 0);
+
+        entry.zone = i;
+        entry.key = offset;
+        g_array_append_val (entries, entry);
+        for (slash = strchr (zone, '/'); slash != NULL; slash = strchr (slash + 1, '/')) {
+            entry.key = offset + (slash + 1 - zone);
+            g_array_append_val (entries, entry);
+        }
+    }
+
+    catalog->normalized = g_string_free (normalized, FALSE);
+    g_array_sort_with_data (entries, compare_entries, catalog->normalized);
+
+    catalog->n_entries = entries->len;
+    catalog->entries = (struct tz_search_entry *) g_array_free (g_steal_pointer (&entries), FALSE);
+    g_debug ("Built time zone search index with %u keys", catalog->n_entries);
+}
+
+static gboolean
+add_result (guint *results,
+            guint n_results,
+            guint zone)
+{
+    guint i;
+
+    for (i = 0; i < n_results; i++)
+        if (results[i] == zone)
+            return FALSE;
+    results[n_results] = zone;
+    return TRUE;
+}
+
+/**
+ * tz_catalog_search:
+ * @catalog: a catalog
+ * @query: what the user typed so far, such as "new y" or "paris"
+ * @results: (out caller-allocates): indexes of the matching zones
+ * @max_results: size of @results
+ *
+ * Look for zones whose identifier, or one of its components, starts with
+ * @query (case insensitive, '_' matching ' '), in alphabetical order of the
+ * matched key. If there are less than @max_results such zones, complete
+ * with zones that contain @query anywhere in their identifier.
+ *
+ * Apart from building the index on first use, this does not allocate.
+ *
+ * Returns: the number of indexes stored into @results
+ */
+
+guint
+tz_catalog_search (TzCatalog *catalog,
+                   const gchar *query,
+                   guint *results,
+                   guint max_results)
+{
+    gchar key[TZ_CATALOG_MAX_QUERY];
+    gsize key_len;
+    guint lo = 0, hi, i, n_results = 0;
+
+    g_return_val_if_fail (catalog != NULL, 0);
+    g_return_val_if_fail (results != NULL || max_results == 0, 0);
+
+    if (query == NULL || max_results == 0 || !normalize_key (query, key, sizeof (key)))
+        return 0;
+    if (catalog->entries == NULL)
+        tz_catalog_build_index (catalog);
+    key_len = strlen (key);
+
+    /* Lower bound of the prefix */
+    hi = catalog->n_entries;
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+
+        if (strcmp (catalog->normalized + catalog->entries[mid].key, key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (i = lo; i < catalog->n_entries && n_results < max_results; i++) {
+        if (strncmp (catalog->normalized + catalog->entries[i].key, key, key_len) != 0)
+            break;
+        if (add_result (results, n_results, catalog->entries[i].zone))
+            n_results++;
+    }
+
+    for (i = 0; i < catalog->n_zones && n_results < max_results; i++)
+        if (strstr (catalog->normalized + catalog->normalized_offsets[i], key) != NULL &&
+            add_result (results, n_results, i))
+            n_results++;
+
+    return n_results;
+}
@@ -0,0 +1,81 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _TZ_CATALOG_H_
+#define _TZ_CATALOG_H_
+
+#include <glib.h>
+
+/**
+ * SECTION: tzcatalog
+ * @short_description: Sorted catalog of the installed time zones
+ * @title: Time zone catalog
+ * @include: tzcatalog.h
+ *
+ * The catalog is built from tzdata.zi (or zone1970.tab/zone.tab, or as a
+ * last resort from the zoneinfo tree itself), sorted, deduplicated, and
+ * filtered so that every identifier has a file under the zoneinfo
+ * directory. It is persisted in a compact cache file which is mmap'ed on
+ * the next start, and rebuilt whenever the tzdata sources are newer than
+ * the cache. The cache also records, for each backward compatible link,
+ * the zone it is an alias for. tzdata.zi also links distinct zones which
+ * merely share their rules since 1970; those are told apart through
+ * zone.tab, and are not aliases.
+ */
+
+typedef struct _TzCatalog TzCatalog;
+
+/* Longest query accepted by tz_catalog_search */
+#define TZ_CATALOG_MAX_QUERY 128
+
+/* Most results returned by a single SearchTimezones call */
+#define TZ_CATALOG_MAX_RESULTS 256
+
+TzCatalog *
+tz_catalog_new (const gchar *zoneinfo_dir,
+                const gchar *cache_filename,
+                GError **error);
+
+void
+tz_catalog_free (TzCatalog *catalog);
+
+gboolean
+tz_catalog_is_stale (TzCatalog *catalog);
+
+guint
+tz_catalog_get_n_zones (TzCatalog *catalog);
+
+const gchar * const *
+tz_catalog_get_zones (TzCatalog *catalog);
+
+gboolean
+tz_catalog_lookup (TzCatalog *catalog,
+                   const gchar *identifier,
+                   guint *index);
+
+const gchar *
+tz_catalog_canonicalize (TzCatalog *catalog,
+                         const gchar *identifier);
+
+guint
+tz_catalog_search (TzCatalog *catalog,
+                   const gchar *query,
+                   guint *results,
+                   guint max_results);
+
+#endif
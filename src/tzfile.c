@@ -0,0 +1,727 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "tzfile.h"
+
+#include "config.h"
+
+#define SECS_PER_DAY 86400
+
+/*
+  A POSIX TZ rule, e.g. "CET-1CEST,M3.5.0,M10.5.0/3": one date at which
+  daylight saving time starts and one at which it ends, both in local
+  time.
+*/
+
+enum tz_rule_date_type {
+    TZ_RULE_JULIAN_NO_LEAP, /* Jn: 1 <= n <= 365, February 29 never counted */
+    TZ_RULE_JULIAN,         /* n: 0 <= n <= 365 */
+    TZ_RULE_MONTH_WEEK_DAY, /* Mm.w.d */
+};
+
+struct tz_rule_date {
+    enum tz_rule_date_type type;
+    gint day;   /* n, or d (0 = Sunday) */
+    gint week;  /* w: 1..5, 5 is the last one */
+    gint month; /* m: 1..12 */
+    gint32 time; /* seconds after local midnight */
+};
+
+struct tz_rule {
+    gchar *std_abbreviation;
+    gint32 std_offset; /* seconds east of UTC */
+    gchar *dst_abbreviation; /* NULL if there is no daylight saving time */
+    gint32 dst_offset;
+    struct tz_rule_date start, end;
+};
+
+/*
+  Decoded transition tables, as a struct of arrays: binary searches only
+  touch the transitions array.
+*/
+
+struct _TzFile {
+    gchar *identifier;
+    struct stat st; /* to notice the file being replaced */
+
+    guint n_transitions;
+    gint64 *transitions;     /* seconds since the epoch, increasing */
+    guint8 *transition_type; /* index in the types arrays */
+
+    guint n_types;
+    gint32 *utc_offsets;
+    guint8 *is_dst;
+    guint8 *abbreviation_index; /* index in abbreviations */
+
+    gchar *abbreviations; /* NUL separated */
+    gsize abbreviations_length;
+
+    gboolean has_rule;
+    struct tz_rule rule;
+};
+
+static gchar *zoneinfo_dir = NULL;
+static GHashTable *tzfile_cache = NULL;
+
+static void
+tz_file_free (TzFile *tzfile)
+{
+    if (tzfile == NULL)
+        return;
+
+    g_free (tzfile->identifier);
+    g_free (tzfile->transitions);
+    g_free (tzfile->transition_type);
+    g_free (tzfile->utc_offsets);
+    g_free (tzfile->is_dst);
+    g_free (tzfile->abbreviation_index);
+    g_free (tzfile->abbreviations);
+    g_free (tzfile->rule.std_abbreviation);
+    g_free (tzfile->rule.dst_abbreviation);
+    g_free (tzfile);
+}
+
+static gint32
+read_be32 (const guint8 *p)
+{
+    return (gint32) (((guint32) p[0] << 24) | ((guint32) p[1] << 16) | ((guint32) p[2] << 8) | p[3]);
+}
+
+static gint64
+read_be64 (const guint8 *p)
+{
+    return (gint64) (((guint64) (guint32) read_be32 (p) << 32) | (guint32) read_be32 (p + 4));
+}
+
+/* Days from 1970-01-01 to year-month-day in the proleptic Gregorian calendar */
+static gint64
+days_from_civil (gint64 year,
+                 gint month,
+                 gint day)
+{
+    gint64 era, yoe, doy, doe;
+
+    year -= month <= 2;
+    era = (year >= 0 ? year : year - 399) / 400;
+    yoe = year - era * 400;
+    doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static gint64
+year_of_days (gint64 days)
+{
+    gint64 era, doe, yoe, doy, mp;
+
+    days += 719468;
+    era = (days >= 0 ? days : days - 146096) / 146097;
+    doe = days - era * 146097;
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+    return yoe + era * 400 + (mp >= 10);
+}
+
+static gboolean
+is_leap_year (gint64 year)
+{
+    return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+/* Parse "[+-]hh[:mm[:ss]]"; hours go up to 167 as allowed by RFC 8536 */
+static const gchar *
+parse_rule_time (const gchar *s,
+                 gint32 *seconds)
+{
+    gint sign = 1, hh = 0, mm = 0, ss = 0;
+
+    if (*s == '+' || *s == '-')
+        sign = *s++ == '-' ? -1 : 1;
+    if (!g_ascii_isdigit (*s))
+        return NULL;
+    while (g_ascii_isdigit (*s) && hh <= 167)
+        hh = hh * 10 + (*s++ - '0');
+    if (*s == ':') {
+        s++;
+        while (g_ascii_isdigit (*s) && mm < 60)
+            mm = mm * 10 + (*s++ - '0');
+        if (*s == ':') {
+            s++;
+            while (g_ascii_isdigit (*s) && ss < 60)
+                ss = ss * 10 + (*s++ - '0');
+        }
+    }
+    if (hh > 167 || mm > 59 || ss > 59)
+        return NULL;
+    *seconds = sign * (hh * 3600 + mm * 60 + ss);
+    return s;
+}
+
+static const gchar *
+parse_rule_abbreviation (const gchar *s,
+                         gchar **abbreviation)
+{
+    const gchar *start;
+
+    if (*s == '<') {
+        start = ++s;
+        while (*s != 0 && *s != '>')
+            s++;
+        if (*s != '>' || s == start)
+            return NULL;
+        *abbreviation = g_strndup (start, s - start);
+        return s + 1;
+    }
+    start = s;
+    while (g_ascii_isalpha (*s))
+        s++;
+    if (s - start < 3)
+        return NULL;
+    *abbreviation = g_strndup (start, s - start);
+    return s;
+}
+
+static const gchar *
+parse_rule_date (const gchar *s,
+                 struct tz_rule_date *date)
+{
+    gchar *end;
+
+    date->time = 2 * 3600;
+    if (*s == 'M') {
+        date->type = TZ_RULE_MONTH_WEEK_DAY;
+        date->month = strtol (s + 1, &end, 10);
+        if (*end != '.')
+            return NULL;
+        date->week = strtol (end + 1, &end, 10);
+        if (*end != '.')
+            return NULL;
+        date->day = strtol (end + 1, &end, 10);
+        if (date->month < 1 || date->month > 12 || date->week < 1 || date->week > 5 ||
+            date->day < 0 || date->day > 6)
+            return NULL;
+    } else if (*s == 'J') {
+        date->type = TZ_RULE_JULIAN_NO_LEAP;
+        date->day = strtol (s + 1, &end, 10);
+        if (end == s + 1 || date->day < 1 || date->day > 365)
+            return NULL;
+    } else if (g_ascii_isdigit (*s)) {
+        date->type = TZ_RULE_JULIAN;
+        date->day = strtol (s, &end, 10);
+        if (date->day > 365)
+            return NULL;
+    } else
+        return NULL;
+
+    s = end;
+    if (*s == '/')
+        s = parse_rule_time (s + 1, &date->time);
+    return s;
+}
+
+/* Parse the TZ string footer of a version 2+ file. An empty string means
+ * that instants after the last transition have no known local time. */
+static gboolean
+parse_rule (const gchar *s,
+            struct tz_rule *rule)
+{
+    gint32 offset;
+
+    if ((s = parse_rule_abbreviation (s, &rule->std_abbreviation)) == NULL ||
+        (s = parse_rule_time (s, &offset)) == NULL)
+        return FALSE;
+    /* POSIX offsets count west of UTC */
+    rule->std_offset = -offset;
+    if (*s == 0)
+        return TRUE;
+
+    if ((s = parse_rule_abbreviation (s, &rule->dst_abbreviation)) == NULL)
+        return FALSE;
+    rule->dst_offset = rule->std_offset + 3600;
+    if (*s != ',' && *s != 0) {
+        if ((s = parse_rule_time (s, &offset)) == NULL)
+            return FALSE;
+        rule->dst_offset = -offset;
+    }
+    if (*s == 0) {
+        /* POSIX leaves the default rule to the implementation; use the
+         * US one, like glibc */
+        rule->start = (struct tz_rule_date) { TZ_RULE_MONTH_WEEK_DAY, 0, 2, 3, 2 * 3600 };
+        rule->end = (struct tz_rule_date) { TZ_RULE_MONTH_WEEK_DAY, 0, 1, 11, 2 * 3600 };
+        return TRUE;
+    }
+    if (*s != ',' || (s = parse_rule_date (s + 1, &rule->start)) == NULL ||
+        *s != ',' || (s = parse_rule_date (s + 1, &rule->end)) == NULL)
+        return FALSE;
+    return *s == 0;
+}
+
+/* Local seconds since the epoch at which @date happens in @year */
+static gint64
+rule_date_local (const struct tz_rule_date *date,
+                 gint64 year)
+{
+    gint64 days;
+
+    switch (date->type) {
+    case TZ_RULE_JULIAN_NO_LEAP:
+        days = days_from_civil (year, 1, 1) + date->day - 1;
+        if (is_leap_year (year) && date->day >= 60)
+            days++;
+        break;
+    case TZ_RULE_JULIAN:
+        days = days_from_civil (year, 1, 1) + date->day;
+        break;
+    case TZ_RULE_MONTH_WEEK_DAY:
+    default: {
+        static const gint month_days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+        gint64 first = days_from_civil (year, date->month, 1);
+        gint wday = (gint) (((first + 4) % 7 + 7) % 7); /* 1970-01-01 was a Thursday */
+        gint mday = 1 + (date->day - wday + 7) % 7 + (date->week - 1) * 7;
+        gint length = month_days[date->month - 1] + (date->month == 2 && is_leap_year (year));
+
+        while (mday > length)
+            mday -= 7;
+        days = first + mday - 1;
+        break;
+    }
+    }
+    return days * SECS_PER_DAY + date->time;
+}
+
+/* UTC instants at which daylight saving time starts and ends in @year */
+static void
+rule_transitions (const struct tz_rule *rule,
+                  gint64 year,
+                  gint64 *start,
+                  gint64 *end)
+{
+    *start = rule_date_local (&rule->start, year) - rule->std_offset;
+    *end = rule_date_local (&rule->end, year) - rule->dst_offset;
+}
+
+static void
+rule_lookup (const struct tz_rule *rule,
+             gint64 t,
+             TzOffset *offset)
+{
+    gboolean dst = FALSE;
+
+    if (rule->dst_abbreviation != NULL) {
+        gint64 start, end;
+
+        rule_transitions (rule, year_of_days ((t + rule->std_offset) / SECS_PER_DAY), &start, &end);
+        if (start < end)
+            dst = t >= start && t < end;
+        else /* southern hemisphere */
+            dst = !(t >= end && t < start);
+    }
+    offset->utc_offset = dst ? rule->dst_offset : rule->std_offset;
+    offset->is_dst = dst;
+    offset->abbreviation = dst ? rule->dst_abbreviation : rule->std_abbreviation;
+}
+
+static gboolean
+rule_next_transition (const struct tz_rule *rule,
+                      gint64 t,
+                      gint64 *next)
+{
+    gint64 year, best = G_MAXINT64;
+
+    if (rule->dst_abbreviation == NULL || rule->std_offset == rule->dst_offset)
+        return FALSE;
+
+    year = year_of_days ((t + rule->std_offset) / SECS_PER_DAY);
+    for (; best == G_MAXINT64; year++) {
+        gint64 start, end;
+
+        rule_transitions (rule, year, &start, &end);
+        if (start > t)
+            best = MIN (best, start);
+        if (end > t)
+            best = MIN (best, end);
+    }
+    *next = best;
+    return TRUE;
+}
+
+/*
+  TZif layout (RFC 8536): a 44 bytes header, a data block with 32-bit
+  times, and for version 2+ a second header, a data block with 64-bit
+  times, and a "\nTZ string\n" footer.
+*/
+
+#define TZIF_HEADER_SIZE 44
+
+struct tzif_counts {
+    guint32 isutcnt, isstdcnt, leapcnt, timecnt, typecnt, charcnt;
+};
+
+static gboolean
+parse_header (const guint8 *p,
+              gsize length,
+              gchar *version,
+              struct tzif_counts *counts)
+{
+    if (length < TZIF_HEADER_SIZE || memcmp (p, "TZif", 4))
+        return FALSE;
+    *version = p[4];
+    counts->isutcnt = read_be32 (p + 20);
+    counts->isstdcnt = read_be32 (p + 24);
+    counts->leapcnt = read_be32 (p + 28);
+    counts->timecnt = read_be32 (p + 32);
+    counts->typecnt = read_be32 (p + 36);
+    counts->charcnt = read_be32 (p + 40);
+    return counts->typecnt > 0 && counts->typecnt <= 256 && counts->charcnt > 0 &&
+           counts->timecnt < (1 << 20) && counts->leapcnt < (1 << 16) && counts->charcnt < (1 << 16) &&
+           (counts->isutcnt == 0 || counts->isutcnt == counts->typecnt) &&
+           (counts->isstdcnt == 0 || counts->isstdcnt == counts->typecnt);
+}
+
+static gsize
+data_block_size (const struct tzif_counts *counts,
+                 gsize time_size)
+{
+    return counts->timecnt * time_size + counts->timecnt + counts->typecnt * 6 +
+           counts->charcnt + counts->leapcnt * (time_size + 4) + counts->isstdcnt + counts->isutcnt;
+}
+
+static TzFile *
+tz_file_parse (const gchar *identifier,
+               const guint8 *p,
+               gsize length,
+               GError **error)
+{
+    TzFile *tzfile = NULL;
+    struct tzif_counts counts;
+    gsize time_size = 4, size;
+    const guint8 *end = p + length;
+    gchar version;
+    guint i;
+
+    if (!parse_header (p, length, &version, &counts))
+        goto invalid;
+    size = data_block_size (&counts, 4);
+    if ((gsize) (end - p) < TZIF_HEADER_SIZE + size)
+        goto invalid;
+
+    /* Prefer the 64-bit data of version 2+ files */
+    if (version >= '2') {
+        p += TZIF_HEADER_SIZE + size;
+        if (!parse_header (p, end - p, &version, &counts))
+            goto invalid;
+        time_size = 8;
+        size = data_block_size (&counts, 8);
+        if ((gsize) (end - p) < TZIF_HEADER_SIZE + size)
+            goto invalid;
+    }
+    p += TZIF_HEADER_SIZE;
+
+    tzfile = g_new0 (TzFile, 1);
+    tzfile->identifier = g_strdup (identifier);
+    tzfile->n_transitions = counts.timecnt;
+    tzfile->transitions = g_new (gint64, counts.timecnt);
+    tzfile->transition_type = g_new (guint8, counts.timecnt);
+    tzfile->n_types = counts.typecnt;
+    tzfile->utc_offsets = g_new (gint32, counts.typecnt);
+    tzfile->is_dst = g_new (guint8, counts.typecnt);
+    tzfile->abbreviation_index = g_new (guint8, counts.typecnt);
+
+    for (i = 0; i < counts.timecnt; i++, p += time_size) {
+        tzfile->transitions[i] = time_size == 8 ? read_be64 (p) : read_be32 (p);
+        if (i > 0 && tzfile->transitions[i] <= tzfile->transitions[i - 1])
+            goto invalid;
+    }
+    for (i = 0; i < counts.timecnt; i++, p++) {
+        if (*p >= counts.typecnt)
+            goto invalid;
+        tzfile->transition_type[i] = *p;
+    }
+    for (i = 0; i < counts.typecnt; i++, p += 6) {
+        tzfile->utc_offsets[i] = read_be32 (p);
+        tzfile->is_dst[i] = p[4] != 0;
+        if (p[5] >= counts.charcnt)
+            goto invalid;
+        tzfile->abbreviation_index[i] = p[5];
+    }
+    /* Make sure every abbreviation is NUL terminated */
+    tzfile->abbreviations_length = counts.charcnt;
+    tzfile->abbreviations = g_malloc (counts.charcnt + 1);
+    memcpy (tzfile->abbreviations, p, counts.charcnt);
+    tzfile->abbreviations[counts.charcnt] = 0;
+    p += counts.charcnt;
+
+    /* Leap second records and the standard/UT indicators are not needed
+     * to compute the offsets */
+    p += counts.leapcnt * (time_size + 4) + counts.isstdcnt + counts.isutcnt;
+
+    if (time_size == 8 && p < end && *p == '\n') {
+        const guint8 *footer = p + 1, *nl = memchr (footer, '\n', end - footer);
+        g_autofree gchar *tz = NULL;
+
+        if (nl == NULL)
+            goto invalid;
+        tz = g_strndup ((const gchar *) footer, nl - footer);
+        if (*tz != 0) {
+            if (!parse_rule (tz, &tzfile->rule)) {
+                g_debug ("Ignoring unsupported TZ string '%s' in %s", tz, identifier);
+                g_clear_pointer (&tzfile->rule.std_abbreviation, g_free);
+                g_clear_pointer (&tzfile->rule.dst_abbreviation, g_free);
+            } else
+                tzfile->has_rule = TRUE;
+        }
+    }
+
+    return tzfile;
+
+  invalid:
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid time zone file for '%s'", identifier);
+    tz_file_free (tzfile);
+    return NULL;
+}
+
+/**
+ * tz_file_cache_init:
+ * @_zoneinfo_dir: the directory holding the compiled time zones
+ *
+ * Set up the cache of decoded time zone files.
+ */
+
+void
+tz_file_cache_init (const gchar *_zoneinfo_dir)
+{
+    g_free (zoneinfo_dir);
+    zoneinfo_dir = g_strdup (_zoneinfo_dir);
+    if (tzfile_cache == NULL)
+        tzfile_cache = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) tz_file_free);
+}
+
+void
+tz_file_cache_destroy (void)
+{
+    g_clear_pointer (&tzfile_cache, g_hash_table_unref);
+    g_clear_pointer (&zoneinfo_dir, g_free);
+}
+
+/**
+ * tz_file_cache_get:
+ * @identifier: a time zone identifier, such as "Europe/Paris"
+ * @error: set if the zone file cannot be read or is invalid
+ *
+ * Return the decoded tables for @identifier, reading the zone file if it
+ * is not in the cache yet, or if it was replaced since it was read.
+ *
+ * Returns: (transfer none) (nullable): the decoded zone, valid until the
+ * next call for the same @identifier
+ */
+
+TzFile *
+tz_file_cache_get (const gchar *identifier,
+                   GError **error)
+{
+    g_autofree gchar *filename = NULL;
+    g_autoptr(GMappedFile) mapped = NULL;
+    TzFile *tzfile;
+    struct stat st;
+
+    g_return_val_if_fail (tzfile_cache != NULL, NULL);
+
+    if (identifier == NULL || *identifier == 0 || *identifier == '/' || strstr (identifier, "..") != NULL) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "Invalid time zone '%s'", identifier);
+        return NULL;
+    }
+
+    filename = g_build_filename (zoneinfo_dir, identifier, NULL);
+    if (g_stat (filename, &st) < 0) {
+        int errsv = errno;
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv), "Unable to read '%s': %s", filename, g_strerror (errsv));
+        return NULL;
+    }
+
+    tzfile = g_hash_table_lookup (tzfile_cache, identifier);
+    if (tzfile != NULL && tzfile->st.st_ino == st.st_ino && tzfile->st.st_dev == st.st_dev &&
+        tzfile->st.st_mtim.tv_sec == st.st_mtim.tv_sec && tzfile->st.st_mtim.tv_nsec == st.st_mtim.tv_nsec)
+        return tzfile;
+
+    if ((mapped = g_mapped_file_new (filename, FALSE, error)) == NULL) {
+        g_prefix_error (error, "Unable to read '%s': ", filename);
+        return NULL;
+    }
+    tzfile = tz_file_parse (identifier,
+                            (const guint8 *) g_mapped_file_get_contents (mapped),
+                            g_mapped_file_get_length (mapped),
+                            error);
+    if (tzfile == NULL)
+        return NULL;
+    tzfile->st = st;
+
+    g_debug ("Loaded %s: %u transitions, %u types%s", identifier,
+             tzfile->n_transitions, tzfile->n_types, tzfile->has_rule ? ", TZ rule" : "");
+    g_hash_table_replace (tzfile_cache, tzfile->identifier, tzfile);
+    return tzfile;
+}
+
+static void
+type_lookup (TzFile *tzfile,
+             guint type,
+             TzOffset *offset)
+{
+    offset->utc_offset = tzfile->utc_offsets[type];
+    offset->is_dst = tzfile->is_dst[type];
+    offset->abbreviation = tzfile->abbreviations + tzfile->abbreviation_index[type];
+}
+
+/* Index of the last transition at or before @t, or -1 */
+static gint
+find_transition (TzFile *tzfile,
+                 gint64 t)
+{
+    guint lo = 0, hi = tzfile->n_transitions;
+
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+
+        if (tzfile->transitions[mid] <= t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (gint) lo - 1;
+}
+
+static void
+lookup_at (TzFile *tzfile,
+           gint i,
+           gint64 t,
+           TzOffset *offset)
+{
+    if (i < 0)
+        /* Before the first transition, RFC 8536 says to use type 0 */
+        type_lookup (tzfile, 0, offset);
+    else if ((guint) i == tzfile->n_transitions - 1 && tzfile->has_rule)
+        rule_lookup (&tzfile->rule, t, offset);
+    else
+        type_lookup (tzfile, tzfile->transition_type[i], offset);
+}
+
+/**
+ * tz_file_lookup:
+ * @tzfile: a decoded zone
+ * @t: seconds since the epoch
+ * @offset: (out caller-allocates): the local time type at @t
+ *
+ * Compute the UTC offset, DST flag and abbreviation in effect at @t.
+ */
+
+void
+tz_file_lookup (TzFile *tzfile,
+                gint64 t,
+                TzOffset *offset)
+{
+    g_return_if_fail (tzfile != NULL && offset != NULL);
+
+    if (tzfile->n_transitions == 0 && tzfile->has_rule)
+        rule_lookup (&tzfile->rule, t, offset);
+    else
+        lookup_at (tzfile, find_transition (tzfile, t), t, offset);
+}
+
+/**
+ * tz_file_lookup_many:
+ * @tzfile: a decoded zone
+ * @times: seconds since the epoch
+ * @n_times: number of elements of @times
+ * @offsets: (out caller-allocates): array of @n_times results
+ *
+ * Batched version of #tz_file_lookup. When @times is sorted, consecutive
+ * instants falling between the same two transitions share one search.
+ */
+
+void
+tz_file_lookup_many (TzFile *tzfile,
+                     const gint64 *times,
+                     guint n_times,
+                     TzOffset *offsets)
+{
+    gint i = -1;
+    guint k;
+
+    g_return_if_fail (tzfile != NULL && (n_times == 0 || (times != NULL && offsets != NULL)));
+
+    if (tzfile->n_transitions == 0) {
+        for (k = 0; k < n_times; k++)
+            tz_file_lookup (tzfile, times[k], &offsets[k]);
+        return;
+    }
+
+    for (k = 0; k < n_times; k++) {
+        gint64 t = times[k];
+
+        /* Is t still in [transitions[i], transitions[i + 1])? */
+        if (k == 0 || (i >= 0 && t < tzfile->transitions[i]) || (i < 0 && t >= tzfile->transitions[0]) ||
+            ((guint) (i + 1) < tzfile->n_transitions && t >= tzfile->transitions[i + 1]))
+            i = find_transition (tzfile, t);
+        lookup_at (tzfile, i, t, &offsets[k]);
+    }
+}
+
+/**
+ * tz_file_next_transition:
+ * @tzfile: a decoded zone
+ * @t: seconds since the epoch
+ * @next: (out): the first instant after @t at which the UTC offset changes
+ *
+ * Returns: %FALSE if the UTC offset of @tzfile never changes after @t
+ */
+
+gboolean
+tz_file_next_transition (TzFile *tzfile,
+                         gint64 t,
+                         gint64 *next)
+{
+    TzOffset current, offset;
+    gint i;
+
+    g_return_val_if_fail (tzfile != NULL && next != NULL, FALSE);
+
+    tz_file_lookup (tzfile, t, &current);
+    /* Skip the transitions which only change the abbreviation */
+    for (i = find_transition (tzfile, t) + 1; (guint) i < tzfile->n_transitions; i++) {
+        lookup_at (tzfile, i, tzfile->transitions[i], &offset);
+        if (offset.utc_offset != current.utc_offset) {
+            *next = tzfile->transitions[i];
+            return TRUE;
+        }
+    }
+
+    if (!tzfile->has_rule)
+        return FALSE;
+    return rule_next_transition (&tzfile->rule, tzfile->n_transitions > 0 ? MAX (t, tzfile->transitions[tzfile->n_transitions - 1]) : t, next);
+}
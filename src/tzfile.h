@@ -0,0 +1,80 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _TZ_FILE_H_
+#define _TZ_FILE_H_
+
+#include <glib.h>
+
+/**
+ * SECTION: tzfile
+ * @short_description: TZif reader and UTC offset queries
+ * @title: Time zone files
+ * @include: tzfile.h
+ *
+ * Reads compiled time zone files (TZif versions 1 to 3, see RFC 8536)
+ * from the zoneinfo directory, and keeps their decoded transition tables
+ * in a cache, so that "what is the UTC offset of zone Z at instant T"
+ * is a binary search. Instants after the last transition are answered
+ * from the POSIX TZ string found at the end of version 2+ files.
+ */
+
+typedef struct _TzFile TzFile;
+
+/**
+ * TzOffset:
+ * @utc_offset: seconds east of UTC
+ * @is_dst: whether daylight saving time is in effect
+ * @abbreviation: the time zone abbreviation, such as "CEST". Owned by the
+ * #TzFile, which stays valid until #tz_file_cache_destroy or until the
+ * zone file is replaced on disk.
+ */
+
+typedef struct {
+    gint32 utc_offset;
+    gboolean is_dst;
+    const gchar *abbreviation;
+} TzOffset;
+
+void
+tz_file_cache_init (const gchar *zoneinfo_dir);
+
+void
+tz_file_cache_destroy (void);
+
+TzFile *
+tz_file_cache_get (const gchar *identifier,
+                   GError **error);
+
+void
+tz_file_lookup (TzFile *tzfile,
+                gint64 t,
+                TzOffset *offset);
+
+void
+tz_file_lookup_many (TzFile *tzfile,
+                     const gint64 *times,
+                     guint n_times,
+                     TzOffset *offsets);
+
+gboolean
+tz_file_next_transition (TzFile *tzfile,
+                         gint64 t,
+                         gint64 *next);
+
+#endif
@@ -0,0 +1,219 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <glib.h>
+
+#include "asynclock.h"
+
+#define N_WAITERS 8
+
+/* The queue-wait test: a call queued behind a holder and N_QUEUED
+ * config calls, each holding the lock for HOLD_MSEC */
+#define N_QUEUED 4
+#define HOLD_MSEC 10
+
+typedef struct _Fixture Fixture;
+
+typedef struct {
+    Fixture *fixture;
+    guint id;
+    gint64 wait;
+} Waiter;
+
+struct _Fixture {
+    AsyncLock *lock;
+    guint hold_msec;
+    Waiter waiters[N_WAITERS];
+    guint order[N_WAITERS];
+    guint n_run;
+};
+
+static void
+fixture_set_up (Fixture *fixture,
+                gconstpointer user_data)
+{
+    fixture->lock = async_lock_new ("test");
+}
+
+static void
+fixture_tear_down (Fixture *fixture,
+                   gconstpointer user_data)
+{
+    g_assert_true (async_lock_try_acquire (fixture->lock));
+    async_lock_release (fixture->lock);
+    async_lock_free (fixture->lock);
+}
+
+static gboolean
+on_hold_over (gpointer user_data)
+{
+    Fixture *fixture = (Fixture *) user_data;
+
+    async_lock_release (fixture->lock);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+on_acquired (gint64 wait,
+             gpointer user_data)
+{
+    Waiter *waiter = (Waiter *) user_data;
+    Fixture *fixture = waiter->fixture;
+
+    waiter->wait = wait;
+    fixture->order[fixture->n_run++] = waiter->id;
+    if (fixture->hold_msec > 0)
+        g_timeout_add (fixture->hold_msec, on_hold_over, fixture);
+    else
+        async_lock_release (fixture->lock);
+}
+
+static void
+queue (Fixture *fixture,
+       guint id,
+       gint priority)
+{
+    Waiter *waiter = &fixture->waiters[id];
+
+    waiter->fixture = fixture;
+    waiter->id = id;
+    async_lock_acquire_async (fixture->lock, priority, on_acquired, waiter);
+}
+
+static void
+run_until (Fixture *fixture,
+           guint n_run)
+{
+    while (fixture->n_run < n_run)
+        g_main_context_iteration (NULL, TRUE);
+}
+
+static void
+test_fifo (Fixture *fixture,
+           gconstpointer user_data)
+{
+    guint i;
+
+    g_assert_true (async_lock_try_acquire (fixture->lock));
+    for (i = 0; i < 3; i++)
+        queue (fixture, i, G_PRIORITY_DEFAULT);
+    async_lock_release (fixture->lock);
+    run_until (fixture, 3);
+
+    for (i = 0; i < 3; i++)
+        g_assert_cmpuint (fixture->order[i], ==, i);
+}
+
+/* A more urgent waiter goes ahead of those queued, not of the holder */
+static void
+test_priority (Fixture *fixture,
+               gconstpointer user_data)
+{
+    g_assert_true (async_lock_try_acquire (fixture->lock));
+    queue (fixture, 0, G_PRIORITY_DEFAULT);
+    queue (fixture, 1, G_PRIORITY_DEFAULT);
+    queue (fixture, 2, G_PRIORITY_HIGH);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    g_assert_cmpuint (fixture->n_run, ==, 0);
+
+    async_lock_release (fixture->lock);
+    run_until (fixture, 3);
+    g_assert_cmpuint (fixture->order[0], ==, 2);
+    g_assert_cmpuint (fixture->order[1], ==, 0);
+    g_assert_cmpuint (fixture->order[2], ==, 1);
+}
+
+static void
+test_try_acquire (Fixture *fixture,
+                  gconstpointer user_data)
+{
+    g_assert_true (async_lock_try_acquire (fixture->lock));
+    g_assert_false (async_lock_try_acquire (fixture->lock));
+
+    /* Handed to the waiter on release, never free in between */
+    fixture->hold_msec = 1;
+    queue (fixture, 0, G_PRIORITY_DEFAULT);
+    async_lock_release (fixture->lock);
+    g_assert_false (async_lock_try_acquire (fixture->lock));
+    run_until (fixture, 1);
+    while (!async_lock_try_acquire (fixture->lock))
+        g_main_context_iteration (NULL, TRUE);
+    async_lock_release (fixture->lock);
+}
+
+/* Returns how long a call queued at @priority, behind a holder and
+ * N_QUEUED config calls, waits for the lock */
+static gint64
+measure_queue_wait (Fixture *fixture,
+                    gint priority)
+{
+    guint i;
+
+    fixture->n_run = 0;
+    fixture->hold_msec = HOLD_MSEC;
+    queue (fixture, 0, G_PRIORITY_DEFAULT);
+    run_until (fixture, 1);
+    for (i = 1; i <= N_QUEUED; i++)
+        queue (fixture, i, G_PRIORITY_DEFAULT);
+    queue (fixture, N_QUEUED + 1, priority);
+    run_until (fixture, N_QUEUED + 2);
+    /* The last one is still held */
+    while (!async_lock_try_acquire (fixture->lock))
+        g_main_context_iteration (NULL, TRUE);
+    async_lock_release (fixture->lock);
+
+    return fixture->waiters[N_QUEUED + 1].wait;
+}
+
+static void
+test_queue_wait (Fixture *fixture,
+                 gconstpointer user_data)
+{
+    gint64 fifo, urgent;
+
+    if (!g_test_perf ()) {
+        g_test_skip ("timing sensitive, run with -m perf");
+        return;
+    }
+
+    fifo = measure_queue_wait (fixture, G_PRIORITY_DEFAULT);
+    urgent = measure_queue_wait (fixture, G_PRIORITY_HIGH);
+
+    g_test_message ("Queue wait behind %d calls holding the lock %d ms each: %" G_GINT64_FORMAT
+                    " us at the default priority, %" G_GINT64_FORMAT " us at a high one",
+                    N_QUEUED + 1, HOLD_MSEC, fifo, urgent);
+    g_test_minimized_result (urgent, "%" G_GINT64_FORMAT " us queue wait at a high priority", urgent);
+    /* Waits for the holder only, instead of every call queued */
+    g_assert_cmpint (urgent, <, 2 * HOLD_MSEC * G_TIME_SPAN_MILLISECOND);
+    g_assert_cmpint (fifo, >=, (N_QUEUED + 1) * HOLD_MSEC * G_TIME_SPAN_MILLISECOND);
+}
+
+int
+main (int argc,
+      char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add ("/asynclock/fifo", Fixture, NULL, fixture_set_up, test_fifo, fixture_tear_down);
+    g_test_add ("/asynclock/priority", Fixture, NULL, fixture_set_up, test_priority, fixture_tear_down);
+    g_test_add ("/asynclock/try-acquire", Fixture, NULL, fixture_set_up, test_try_acquire, fixture_tear_down);
+    g_test_add ("/asynclock/queue-wait", Fixture, NULL, fixture_set_up, test_queue_wait, fixture_tear_down);
+
+    return g_test_run ();
+}
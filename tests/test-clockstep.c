@@ -0,0 +1,112 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <errno.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include "clockstep.h"
+
+/* Small relative steps, alternating forward and back, so that the
+ * clock ends where it started but for the time lost by each step */
+#define N_STEPS 10000
+#define STEP_USEC 1000
+
+/* The read-modify-write clock_step replaced, as a reference */
+static int
+step_with_settime (gint64 usec)
+{
+    struct timespec ts;
+
+    if (clock_gettime (CLOCK_REALTIME, &ts) < 0)
+        return -errno;
+    ts.tv_sec += usec / G_USEC_PER_SEC;
+    ts.tv_nsec += (usec % G_USEC_PER_SEC) * 1000;
+    if (ts.tv_nsec < 0) {
+        ts.tv_sec--;
+        ts.tv_nsec += 1000000000;
+    } else if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    if (clock_settime (CLOCK_REALTIME, &ts) < 0)
+        return -errno;
+    return 0;
+}
+
+/* Returns the microseconds CLOCK_REALTIME lost over N_STEPS steps */
+static gint64
+measure_loss (int (*step) (gint64))
+{
+    gint64 before;
+    guint i;
+
+    before = clock_step_realtime_offset ();
+    for (i = 0; i < N_STEPS; i++)
+        g_assert_cmpint (step (i % 2 ? -STEP_USEC : STEP_USEC), ==, 0);
+    return before - clock_step_realtime_offset ();
+}
+
+static void
+test_realtime_offset (void)
+{
+    gint64 offset;
+
+    /* Nothing steps the clock in between */
+    offset = clock_step_realtime_offset ();
+    g_assert_cmpint (ABS (clock_step_realtime_offset () - offset), <, 10 * G_TIME_SPAN_MILLISECOND);
+}
+
+static void
+test_accuracy (void)
+{
+    gint64 settime_loss, step_loss;
+    int r;
+
+    if (!g_test_perf ()) {
+        g_test_skip ("steps the system clock, run with -m perf");
+        return;
+    }
+    if ((r = clock_step (0)) < 0) {
+        g_test_skip (r == -EPERM ? "needs CAP_SYS_TIME" : "ADJ_SETOFFSET not supported");
+        return;
+    }
+
+    settime_loss = measure_loss (step_with_settime);
+    step_loss = measure_loss (clock_step);
+    /* Give back what the reference lost */
+    g_assert_cmpint (clock_step (settime_loss + step_loss), ==, 0);
+
+    g_test_message ("Time lost over %d steps of %d us: %" G_GINT64_FORMAT " us with clock_settime, %"
+                    G_GINT64_FORMAT " us with ADJ_SETOFFSET", N_STEPS, STEP_USEC, settime_loss, step_loss);
+    g_test_minimized_result ((gdouble) step_loss / N_STEPS, "%.3f us lost per step", (gdouble) step_loss / N_STEPS);
+    g_assert_cmpint (ABS (step_loss), <, settime_loss);
+}
+
+int
+main (int argc,
+      char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/clockstep/realtime-offset", test_realtime_offset);
+    g_test_add_func ("/clockstep/accuracy", test_accuracy);
+
+    return g_test_run ();
+}
@@ -0,0 +1,194 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <time.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "copypaste/hwclock.h"
+#include "rtcdrift.h"
+#include "rtcfake.h"
+#include "settingsjournal.h"
+
+/* 500 ppm, in seconds per day */
+#define FAKE_DRIFT_PPM 500
+#define FAKE_DRIFT_FACTOR (FAKE_DRIFT_PPM * 86400 / 1e6)
+
+typedef struct {
+    gchar *dir;
+    gchar *adjtime;
+} Fixture;
+
+static void
+fixture_set_up (Fixture *fixture,
+                gconstpointer user_data)
+{
+    RtcFakeParameters parameters = { 0, 0, FAKE_DRIFT_PPM, FALSE };
+    gchar *journal;
+
+    fixture->dir = g_dir_make_tmp ("test-rtcdrift-XXXXXX", NULL);
+    g_assert_nonnull (fixture->dir);
+    fixture->adjtime = g_build_filename (fixture->dir, "adjtime", NULL);
+    journal = g_build_filename (fixture->dir, "settings.journal", NULL);
+    settings_journal_init (journal, SETTINGS_DURABILITY_NONE);
+    g_free (journal);
+
+    hwclock_set_backend (rtc_fake_init (&parameters));
+}
+
+static void
+fixture_tear_down (Fixture *fixture,
+                   gconstpointer user_data)
+{
+    rtc_drift_destroy ();
+    hwclock_set_backend (NULL);
+    rtc_fake_destroy ();
+    settings_journal_destroy ();
+    g_unlink (fixture->adjtime);
+    g_rmdir (fixture->dir);
+    g_free (fixture->adjtime);
+    g_free (fixture->dir);
+}
+
+/* Sets the fake rtc to @system, truncated to the second */
+static gint64
+set_rtc (gint64 system)
+{
+    time_t t = system / G_USEC_PER_SEC;
+    struct tm tm;
+
+    gmtime_r (&t, &tm);
+    g_assert_cmpint (hwclock_set_time (&tm), ==, 0);
+    return (gint64) t * G_USEC_PER_SEC;
+}
+
+static gint64
+read_rtc (void)
+{
+    struct tm tm;
+
+    g_assert_cmpint (hwclock_get_time (&tm), ==, 0);
+    return (gint64) timegm (&tm) * G_USEC_PER_SEC;
+}
+
+/* Samples the fake rtc every @interval seconds for @span, sets it, and
+ * returns the drift factor fitted */
+static gdouble
+sample_fake_rtc (Fixture *fixture,
+                 guint interval,
+                 gint64 span)
+{
+    gint64 system, start;
+
+    rtc_drift_init (fixture->adjtime, interval, NULL, NULL);
+    start = system = set_rtc (g_get_real_time ());
+    rtc_drift_rtc_set (system, FALSE);
+    while (system - start < span) {
+        rtc_fake_advance (interval * G_USEC_PER_SEC);
+        system += interval * G_USEC_PER_SEC;
+        rtc_drift_add_sample (system, read_rtc ());
+    }
+    rtc_drift_rtc_set (set_rtc (system), FALSE);
+    return rtc_drift_get_factor ();
+}
+
+/* The shortest interval rtcdriftinterval allows: the samples kept must
+ * still span the 4 hours needed for a fit. The rtc is read to the second,
+ * which takes a day of samples to average out */
+static void
+test_short_interval (Fixture *fixture,
+                     gconstpointer user_data)
+{
+    gdouble factor = sample_fake_rtc (fixture, 60, G_TIME_SPAN_DAY);
+
+    g_assert_cmpfloat_with_epsilon (factor, FAKE_DRIFT_FACTOR, 1.0);
+}
+
+static void
+test_long_interval (Fixture *fixture,
+                    gconstpointer user_data)
+{
+    gdouble factor = sample_fake_rtc (fixture, 3600, 2 * G_TIME_SPAN_DAY);
+
+    g_assert_cmpfloat_with_epsilon (factor, FAKE_DRIFT_FACTOR, 1.0);
+}
+
+/* Under the span, nothing is fitted */
+static void
+test_too_short_span (Fixture *fixture,
+                     gconstpointer user_data)
+{
+    gdouble factor = sample_fake_rtc (fixture, 60, 3 * G_TIME_SPAN_HOUR);
+
+    g_assert_cmpfloat (factor, ==, 0);
+}
+
+static gchar *
+read_adjtime (Fixture *fixture)
+{
+    gchar *contents = NULL;
+
+    g_file_get_contents (fixture->adjtime, &contents, NULL, NULL);
+    return contents;
+}
+
+/* /etc/adjtime is rewritten when the drift changes, from the main loop
+ * rather than the rtc write, and with the date of the last write on
+ * exit */
+static void
+test_save (Fixture *fixture,
+           gconstpointer user_data)
+{
+    gchar *fitted, *contents;
+
+    sample_fake_rtc (fixture, 3600, G_TIME_SPAN_DAY);
+    g_assert_null (read_adjtime (fixture));
+    /* Written from a worker thread once the main loop is idle */
+    while ((fitted = read_adjtime (fixture)) == NULL)
+        g_main_context_iteration (NULL, TRUE);
+
+    /* No new sample: nothing to fit, nothing to save */
+    rtc_fake_advance (G_TIME_SPAN_HOUR);
+    rtc_drift_rtc_set (set_rtc (g_get_real_time () + G_TIME_SPAN_DAY + G_TIME_SPAN_HOUR), FALSE);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    contents = read_adjtime (fixture);
+    g_assert_cmpstr (contents, ==, fitted);
+    g_free (contents);
+
+    rtc_drift_destroy ();
+    contents = read_adjtime (fixture);
+    g_assert_cmpstr (contents, !=, fitted);
+    g_free (contents);
+    g_free (fitted);
+}
+
+int
+main (int argc,
+      char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add ("/rtcdrift/short-interval", Fixture, NULL, fixture_set_up, test_short_interval, fixture_tear_down);
+    g_test_add ("/rtcdrift/long-interval", Fixture, NULL, fixture_set_up, test_long_interval, fixture_tear_down);
+    g_test_add ("/rtcdrift/too-short-span", Fixture, NULL, fixture_set_up, test_too_short_span, fixture_tear_down);
+    g_test_add ("/rtcdrift/save", Fixture, NULL, fixture_set_up, test_save, fixture_tear_down);
+
+    return g_test_run ();
+}
@@ -0,0 +1,252 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "settingsjournal.h"
+
+/* Commits timed by the latency tests, each replacing the files an
+ * ApplySettings touches */
+#define N_COMMITS 50
+
+#define TIMEZONE_CONTENTS "Europe/Paris\n"
+#define HWCLOCK_CONTENTS "LOCAL_RTC=\"no\"\n"
+#define LOCALTIME_TARGET "../usr/share/zoneinfo/Europe/Paris"
+
+static const gchar * const durability_names[] = { "none", "data", "full" };
+
+typedef struct {
+    gchar *dir;
+    gchar *journal;
+    gchar *timezone;
+    gchar *localtime;
+    gchar *hwclock;
+} Fixture;
+
+static void
+fixture_set_up (Fixture *fixture,
+                gconstpointer user_data)
+{
+    fixture->dir = g_dir_make_tmp ("test-settingsjournal-XXXXXX", NULL);
+    g_assert_nonnull (fixture->dir);
+    fixture->journal = g_build_filename (fixture->dir, "settings.journal", NULL);
+    fixture->timezone = g_build_filename (fixture->dir, "timezone", NULL);
+    fixture->localtime = g_build_filename (fixture->dir, "localtime", NULL);
+    fixture->hwclock = g_build_filename (fixture->dir, "hwclock", NULL);
+    g_assert_true (g_file_set_contents (fixture->timezone, "UTC\n", -1, NULL));
+    g_assert_cmpint (symlink ("../usr/share/zoneinfo/UTC", fixture->localtime), ==, 0);
+    g_assert_true (g_file_set_contents (fixture->hwclock, "LOCAL_RTC=\"yes\"\n", -1, NULL));
+    settings_journal_init (fixture->journal, GPOINTER_TO_INT (user_data));
+}
+
+static void
+fixture_tear_down (Fixture *fixture,
+                   gconstpointer user_data)
+{
+    settings_journal_destroy ();
+    g_unlink (fixture->timezone);
+    g_unlink (fixture->localtime);
+    g_unlink (fixture->hwclock);
+    g_rmdir (fixture->dir);
+    g_free (fixture->hwclock);
+    g_free (fixture->localtime);
+    g_free (fixture->timezone);
+    g_free (fixture->journal);
+    g_free (fixture->dir);
+}
+
+static SettingsTransaction *
+stage (Fixture *fixture)
+{
+    SettingsTransaction *transaction;
+    g_autoptr(GFile) timezone = g_file_new_for_path (fixture->timezone);
+    g_autoptr(GFile) localtime = g_file_new_for_path (fixture->localtime);
+    g_autoptr(GFile) hwclock = g_file_new_for_path (fixture->hwclock);
+    GError *err = NULL;
+
+    transaction = settings_transaction_new ();
+    settings_transaction_replace (transaction, timezone, TIMEZONE_CONTENTS, strlen (TIMEZONE_CONTENTS), 0644, &err);
+    g_assert_no_error (err);
+    settings_transaction_symlink (transaction, localtime, LOCALTIME_TARGET, &err);
+    g_assert_no_error (err);
+    settings_transaction_replace (transaction, hwclock, HWCLOCK_CONTENTS, strlen (HWCLOCK_CONTENTS), 0644, &err);
+    g_assert_no_error (err);
+    return transaction;
+}
+
+/* Whether @dir holds nothing but the three settings files */
+static gboolean
+only_targets (Fixture *fixture)
+{
+    GDir *dir;
+    const gchar *name;
+    guint n = 0;
+
+    dir = g_dir_open (fixture->dir, 0, NULL);
+    g_assert_nonnull (dir);
+    while ((name = g_dir_read_name (dir)) != NULL)
+        n++;
+    g_dir_close (dir);
+    return n == 3;
+}
+
+static void
+assert_file (const gchar *filename,
+             const gchar *expected)
+{
+    g_autofree gchar *contents = NULL;
+
+    g_assert_true (g_file_get_contents (filename, &contents, NULL, NULL));
+    g_assert_cmpstr (contents, ==, expected);
+}
+
+static void
+test_commit (Fixture *fixture,
+             gconstpointer user_data)
+{
+    SettingsTransaction *transaction;
+    g_autofree gchar *target = NULL;
+    GError *err = NULL;
+
+    transaction = stage (fixture);
+    assert_file (fixture->timezone, "UTC\n");
+    g_assert_true (settings_transaction_commit (transaction, &err));
+    g_assert_no_error (err);
+    settings_transaction_free (transaction);
+
+    assert_file (fixture->timezone, TIMEZONE_CONTENTS);
+    assert_file (fixture->hwclock, HWCLOCK_CONTENTS);
+    target = g_file_read_link (fixture->localtime, NULL);
+    g_assert_cmpstr (target, ==, LOCALTIME_TARGET);
+    /* Neither the journal nor a staged file is left behind */
+    g_assert_true (only_targets (fixture));
+}
+
+static void
+test_discard (Fixture *fixture,
+              gconstpointer user_data)
+{
+    settings_transaction_free (stage (fixture));
+
+    assert_file (fixture->timezone, "UTC\n");
+    assert_file (fixture->hwclock, "LOCAL_RTC=\"yes\"\n");
+    g_assert_true (only_targets (fixture));
+}
+
+/* The writes the journal replaced, as a reference: each file on its
+ * own, like g_file_replace_contents, flushed then renamed over its
+ * target; the symbolic link deleted then created again */
+static void
+replace_one (const gchar *filename,
+             const gchar *contents)
+{
+    g_autofree gchar *tmp = g_strdup_printf ("%s.XXXXXX", filename);
+    int fd;
+
+    fd = g_mkstemp (tmp);
+    g_assert_cmpint (fd, >=, 0);
+    g_assert_cmpint (write (fd, contents, strlen (contents)), ==, strlen (contents));
+    g_assert_cmpint (fsync (fd), ==, 0);
+    g_assert_cmpint (close (fd), ==, 0);
+    g_assert_cmpint (rename (tmp, filename), ==, 0);
+}
+
+static void
+write_one_at_a_time (Fixture *fixture)
+{
+    replace_one (fixture->timezone, TIMEZONE_CONTENTS);
+    g_assert_cmpint (g_unlink (fixture->localtime), ==, 0);
+    g_assert_cmpint (symlink (LOCALTIME_TARGET, fixture->localtime), ==, 0);
+    replace_one (fixture->hwclock, HWCLOCK_CONTENTS);
+}
+
+static void
+write_journaled (Fixture *fixture)
+{
+    SettingsTransaction *transaction;
+    GError *err = NULL;
+
+    transaction = stage (fixture);
+    settings_transaction_commit (transaction, &err);
+    g_assert_no_error (err);
+    settings_transaction_free (transaction);
+}
+
+/* Returns the average latency of @write in microseconds, staging
+ * included */
+static gdouble
+measure_latency (Fixture *fixture,
+                 void (*write) (Fixture *))
+{
+    gint64 start;
+    guint i;
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < N_COMMITS; i++)
+        write (fixture);
+    return (gdouble) (g_get_monotonic_time () - start) / N_COMMITS;
+}
+
+/* Measured once per durability policy, passed as @user_data */
+static void
+test_latency (Fixture *fixture,
+              gconstpointer user_data)
+{
+    const gchar *policy = durability_names[GPOINTER_TO_INT (user_data)];
+    gdouble reference, journaled;
+
+    if (!g_test_perf ()) {
+        g_test_skip ("flushes to storage, run with -m perf");
+        return;
+    }
+
+    reference = measure_latency (fixture, write_one_at_a_time);
+    journaled = measure_latency (fixture, write_journaled);
+
+    g_test_message ("Replacing 3 files in %s: %.0f us one at a time, %.0f us through the journal with the %s policy",
+                    g_get_tmp_dir (), reference, journaled, policy);
+    g_test_minimized_result (journaled, "%.0f us per commit with the %s policy", journaled, policy);
+    g_assert_true (only_targets (fixture));
+}
+
+int
+main (int argc,
+      char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add ("/settingsjournal/commit", Fixture, GINT_TO_POINTER (SETTINGS_DURABILITY_FULL),
+                fixture_set_up, test_commit, fixture_tear_down);
+    g_test_add ("/settingsjournal/discard", Fixture, GINT_TO_POINTER (SETTINGS_DURABILITY_FULL),
+                fixture_set_up, test_discard, fixture_tear_down);
+    g_test_add ("/settingsjournal/latency/none", Fixture, GINT_TO_POINTER (SETTINGS_DURABILITY_NONE),
+                fixture_set_up, test_latency, fixture_tear_down);
+    g_test_add ("/settingsjournal/latency/data", Fixture, GINT_TO_POINTER (SETTINGS_DURABILITY_DATA),
+                fixture_set_up, test_latency, fixture_tear_down);
+    g_test_add ("/settingsjournal/latency/full", Fixture, GINT_TO_POINTER (SETTINGS_DURABILITY_FULL),
+                fixture_set_up, test_latency, fixture_tear_down);
+
+    return g_test_run ();
+}
@@ -0,0 +1,164 @@
+/*
+  Copyright 2026 timedated contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdlib.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include "tzfile.h"
+
+/* Where glibc reads the zones from too, so both answer from the same
+ * files */
+#define DEFAULT_ZONEINFO_DIR "/usr/share/zoneinfo"
+
+/* Covers the last transitions listed in the files, slim or fat, and
+ * years answered from their POSIX TZ string */
+#define FROM_YEAR 2000
+#define TO_YEAR 2045
+
+/* Shorter than any period between two transitions of the zones below */
+#define PROBE_STEP 3600
+
+static const gchar *zones[] = {
+    /* Follows the EU rules from a -02 standard time since 2023, after
+     * years of -03 with DST */
+    "America/Nuuk",
+    /* A 45 minute offset, and a southern hemisphere DST across the new
+     * year */
+    "Pacific/Chatham",
+    /* Negative DST: GMT in winter is the daylight saving time, in the
+     * transitions as well as in the POSIX TZ string */
+    "Europe/Dublin",
+};
+
+static const gchar *zoneinfo_dir = NULL;
+
+static gint64
+utc_time (gint year)
+{
+    struct tm tm = { 0 };
+
+    tm.tm_year = year - 1900;
+    tm.tm_mday = 1;
+    return (gint64) timegm (&tm);
+}
+
+static void
+localtime_at (gint64 t,
+              struct tm *tm)
+{
+    time_t tt = (time_t) t;
+
+    g_assert_nonnull (localtime_r (&tt, tm));
+}
+
+static void
+check_offset (const gchar *identifier,
+              TzFile *tzfile,
+              gint64 t)
+{
+    TzOffset offset;
+    struct tm tm;
+
+    tz_file_lookup (tzfile, t, &offset);
+    localtime_at (t, &tm);
+    if (offset.utc_offset != tm.tm_gmtoff)
+        g_error ("%s at %" G_GINT64_FORMAT ": UTC offset %d, localtime_r says %ld",
+                 identifier, t, offset.utc_offset, tm.tm_gmtoff);
+    g_assert_cmpstr (offset.abbreviation, ==, tm.tm_zone);
+    g_assert_cmpint (offset.is_dst, ==, tm.tm_isdst > 0);
+}
+
+/* Walks the transitions of a zone through the years, checking each one
+ * and every hour in between against localtime_r, so that neither a
+ * wrong transition nor a missed one goes unnoticed */
+static void
+test_zone (gconstpointer user_data)
+{
+    const gchar *identifier = user_data;
+    GError *err = NULL;
+    TzFile *tzfile;
+    gchar *path;
+    gint64 t, next, probe, to = utc_time (TO_YEAR);
+    guint transitions = 0;
+    struct tm before, after;
+
+    path = g_build_filename (zoneinfo_dir, identifier, NULL);
+    if (!g_file_test (path, G_FILE_TEST_EXISTS)) {
+        g_test_skip ("zone not installed");
+        g_free (path);
+        return;
+    }
+    g_free (path);
+
+    tzfile = tz_file_cache_get (identifier, &err);
+    g_assert_no_error (err);
+    g_assert_nonnull (tzfile);
+
+    g_setenv ("TZ", identifier, TRUE);
+    tzset ();
+
+    for (t = utc_time (FROM_YEAR); t < to; t = next) {
+        if (!tz_file_next_transition (tzfile, t, &next))
+            next = to;
+        g_assert_cmpint (next, >, t);
+        next = MIN (next, to);
+
+        for (probe = t; probe < next; probe += PROBE_STEP)
+            check_offset (identifier, tzfile, probe);
+        check_offset (identifier, tzfile, next - 1);
+        if (next == to)
+            break;
+
+        localtime_at (next - 1, &before);
+        localtime_at (next, &after);
+        if (before.tm_gmtoff == after.tm_gmtoff)
+            g_error ("%s: no UTC offset change at %" G_GINT64_FORMAT, identifier, next);
+        check_offset (identifier, tzfile, next);
+        transitions++;
+    }
+
+    /* Two a year, but a single one for Nuuk in 2023 */
+    g_assert_cmpuint (transitions, >, 2 * (TO_YEAR - FROM_YEAR) - 4);
+}
+
+int
+main (int argc,
+      char **argv)
+{
+    guint i;
+
+    g_test_init (&argc, &argv, NULL);
+
+    zoneinfo_dir = g_getenv ("TZDIR");
+    if (zoneinfo_dir == NULL)
+        zoneinfo_dir = DEFAULT_ZONEINFO_DIR;
+    tz_file_cache_init (zoneinfo_dir);
+
+    for (i = 0; i < G_N_ELEMENTS (zones); i++) {
+        gchar *name = g_strdup_printf ("/tzfile/%s", zones[i]);
+
+        g_test_add_data_func (name, zones[i], test_zone);
+        g_free (name);
+    }
+
+    i = g_test_run ();
+    tz_file_cache_destroy ();
+    return i;
+}